@@ -0,0 +1,105 @@
+#pragma once
+//Batch mode files. A manifest has one job per line: the guest ELF followed by the same options
+//the command line takes (--core, --ram, --harts, --limit, ...); blank lines and lines starting
+//with '#' are skipped, arguments with spaces go in double quotes. Results are written as JSON,
+//one object per job in manifest order.
+#include<cstdint>
+#include<cstdio>
+#include<fstream>
+#include<string>
+#include<vector>
+
+struct Batch_Job{
+    int line = 0;   //Manifest line, for error messages
+    std::vector<std::string> args;  //ELF path and options
+
+    //Filled in by the run
+    std::string status = "not_run"; //exited, fault, limit, halted, error
+    uint32_t exit_code = 0;
+    uint64_t inst_count = 0;
+    uint64_t cycle_count = 0;
+    double seconds = 0;
+    std::string output; //UART and write syscall output, trace dumps and faults
+};
+
+inline bool Split_Arguments(const std::string& text, std::vector<std::string>& args){
+    size_t i = 0;
+    while(i < text.size()){
+        if(text[i] == ' ' || text[i] == '\t' || text[i] == '\r'){
+            i++;
+            continue;
+        }
+
+        std::string arg;
+        while(i < text.size() && text[i] != ' ' && text[i] != '\t' && text[i] != '\r'){
+            if(text[i] != '"'){
+                arg += text[i++];
+                continue;
+            }
+            size_t close = text.find('"', i + 1);
+            if(close == std::string::npos) return false;    //Unterminated quote
+            arg += text.substr(i + 1, close - i - 1);
+            i = close + 1;
+        }
+        args.push_back(arg);
+    }
+    return true;
+}
+
+inline bool Read_Manifest(const std::string& path, std::vector<Batch_Job>& jobs){
+    std::ifstream file(path);
+    if(!file.is_open()) return false;
+
+    std::string text;
+    for(int line = 1; std::getline(file, text); line++){
+        Batch_Job job;
+        job.line = line;
+        if(!Split_Arguments(text, job.args)) return false;
+        if(job.args.empty() || job.args[0][0] == '#') continue;
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+inline std::string Json_String(const std::string& text){
+    std::string out = "\"";
+    for(unsigned char c : text){
+        if(c == '"') out += "\\\"";
+        else if(c == '\\') out += "\\\\";
+        else if(c == '\n') out += "\\n";
+        else if(c == '\r') out += "\\r";
+        else if(c == '\t') out += "\\t";
+        else if(c < 0x20 || c >= 0x7F){ //Guest bytes, not necessarily UTF-8
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out += escape;
+        }
+        else out += (char)c;
+    }
+    return out + "\"";
+}
+
+inline bool Write_Results(const std::string& path, const std::vector<Batch_Job>& jobs){
+    std::ofstream file(path, std::ios::trunc);
+    if(!file.is_open()) return false;
+
+    file << "[\n";
+    for(size_t i = 0; i < jobs.size(); i++){
+        const Batch_Job& job = jobs[i];
+        std::string args;
+        for(size_t a = 1; a < job.args.size(); a++) args += (a > 1 ? " " : "") + job.args[a];
+
+        file << "  {\"line\": " << job.line
+             << ", \"elf\": " << Json_String(job.args[0])
+             << ", \"args\": " << Json_String(args)
+             << ", \"status\": " << Json_String(job.status)
+             << ", \"exit_code\": " << job.exit_code
+             << ", \"instructions\": " << job.inst_count
+             << ", \"cycles\": " << job.cycle_count
+             << ", \"seconds\": " << job.seconds
+             << ", \"output\": " << Json_String(job.output) << "}"
+             << (i + 1 < jobs.size() ? ",\n" : "\n");
+    }
+    file << "]\n";
+    return (bool)file;
+}
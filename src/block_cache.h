@@ -0,0 +1,76 @@
+#pragma once
+//Registry of translated guest basic blocks, shared by the JIT and the micro-op IR tiers.
+//Blocks are found through a direct-mapped table in front of a hash map, profiled until
+//they are hot, and retired (not freed) when a guest store hits them, because the block
+//doing the store may still be running.
+#include<cstdint>
+#include<unordered_map>
+#include<vector>
+
+static const uint32_t BLOCK_MAX_LENGTH = 64;   //Longest block we translate (guest instructions)
+static const uint32_t BLOCK_TABLE_SIZE = 4096;  //Direct-mapped lookup slots
+static const uint32_t BLOCK_HOT_THRESHOLD = 32; //Block entries before a block gets translated
+
+template<class Block>   //Block needs start_pc, end_pc (first byte past it) and count (guest instructions)
+struct Block_Cache{
+    std::unordered_map<uint32_t, uint32_t> profile;  //Entry counts of blocks not translated yet
+    std::unordered_map<uint32_t, Block*> blocks; //Translated blocks by start PC
+    std::vector<Block*> retired;    //Invalidated blocks, freed by Reclaim()
+    Block* table[BLOCK_TABLE_SIZE] = {};
+    uint32_t epoch = 0; //Bumped whenever a block goes away, so cached links can be revalidated
+    uint64_t compiled = 0;  //Blocks translated so far
+
+    ~Block_Cache(){ Flush(); }
+
+    Block*& Slot(uint32_t pc){ return table[(pc >> 2) & (BLOCK_TABLE_SIZE - 1)]; }
+
+    Block* Lookup(uint32_t pc){
+        Block*& slot = Slot(pc);
+        if(slot && slot->start_pc == pc) return slot;
+
+        auto it = blocks.find(pc);
+        if(it == blocks.end()) return nullptr;
+        slot = it->second;
+        return slot;
+    }
+
+    bool Hot(uint32_t pc){ return ++profile[pc] >= BLOCK_HOT_THRESHOLD; }   //Counts one entry
+    void Cool(uint32_t pc){ profile[pc] = 0; }  //Restart profiling, e.g. after a failed translation
+
+    void Insert(Block* block){
+        blocks[block->start_pc] = block;
+        Slot(block->start_pc) = block;
+        compiled++;
+    }
+
+    bool Invalidate(uint32_t addr, uint32_t size){  //Retires blocks overlapping [addr, addr + size)
+        bool hit = false;
+        for(auto it = blocks.begin(); it != blocks.end();){
+            Block* block = it->second;
+            if(addr < block->end_pc && block->start_pc < addr + size){
+                if(Slot(block->start_pc) == block) Slot(block->start_pc) = nullptr;
+                profile[block->start_pc] = 0;
+                retired.push_back(block);
+                it = blocks.erase(it);
+                hit = true;
+            }
+            else ++it;
+        }
+        if(hit) epoch++;
+        return hit;
+    }
+
+    void Reclaim(){ //Frees retired blocks; only while no block is executing
+        for(auto block : retired) delete block;
+        retired.clear();
+    }
+
+    void Flush(){   //Drops every translation; only while no block is executing
+        for(auto& it : blocks) delete it.second;
+        blocks.clear();
+        Reclaim();
+        profile.clear();
+        for(auto& slot : table) slot = nullptr;
+        epoch++;
+    }
+};
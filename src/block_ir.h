@@ -0,0 +1,229 @@
+#pragma once
+//Micro-op IR for the block core.
+//A guest basic block is lifted into a short array of Uops with every PC value already
+//resolved (AUIPC, JAL links and branch targets become constants), then a few cheap passes
+//run over it before it is handed to the IR interpreter in RUN_BLOCK.
+#include<cstdint>
+#include<vector>
+
+#include "isa.h"
+
+enum Uop_Kind : uint8_t{
+    U_LI,   //x[rd] = imm
+    //x[rd] = x[rs1] op x[rs2]
+    U_ADD, U_SUB, U_SLL, U_SLT, U_SLTU, U_XOR, U_SRL, U_SRA, U_OR, U_AND,
+    U_MUL, U_MULH, U_MULHSU, U_MULHU, U_DIV, U_DIVU, U_REM, U_REMU,
+    //x[rd] = x[rs1] op imm
+    U_ADDI, U_SLTI, U_SLTIU, U_XORI, U_ORI, U_ANDI, U_SLLI, U_SRLI, U_SRAI,
+    //Memory: address x[rs1] + imm, index = guest instruction within the block
+    U_LB, U_LH, U_LW, U_LBU, U_LHU,
+    U_SB, U_SH, U_SW,
+    //Terminators: imm = target, aux = fall-through / link address
+    U_BEQ, U_BNE, U_BLT, U_BGE, U_BLTU, U_BGEU,
+    U_JAL,
+    U_JALR, //imm is the offset here, target = (x[rs1] + imm) & ~1
+    U_EXIT  //Straight-line block ran out: PC = imm
+};
+
+struct Uop{
+    uint8_t kind;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint32_t imm;
+    uint32_t aux;
+    uint32_t index;
+};
+
+struct Ir_Block{    //A lifted and optimized guest basic block
+    uint32_t start_pc;
+    uint32_t end_pc;    //First byte past the block
+    uint32_t count; //Guest instructions in the block
+    std::vector<Uop> uops;
+    std::vector<uint32_t> raw;  //Guest words and RVC parcels, replayed into the flight recorder
+    Ir_Block* next[2] = {nullptr, nullptr}; //Chained successors: taken / fall-through
+    uint32_t next_epoch[2] = {0, 0};    //Block_Cache epoch each link was made in
+};
+
+inline bool Uop_Pure(uint8_t kind){ return kind <= U_SRAI; }    //Writes rd, no side effects
+inline bool Uop_Memory(uint8_t kind){ return kind >= U_LB && kind <= U_SW; }    //May leave the block early
+inline bool Uop_Reg_Reg(uint8_t kind){ return kind >= U_ADD && kind <= U_REMU; }
+
+inline uint32_t Uop_Eval(uint8_t kind, uint32_t a, uint32_t b){    //ALU semantics, b = x[rs2] or imm
+    switch(kind){
+        case U_ADD: case U_ADDI: return a + b;
+        case U_SUB: return a - b;
+        case U_SLL: case U_SLLI: return a << (b & 0x1F);
+        case U_SLT: case U_SLTI: return (int32_t)a < (int32_t)b ? 1 : 0;
+        case U_SLTU: case U_SLTIU: return a < b ? 1 : 0;
+        case U_XOR: case U_XORI: return a ^ b;
+        case U_SRL: case U_SRLI: return a >> (b & 0x1F);
+        case U_SRA: case U_SRAI: return (uint32_t)((int32_t)a >> (b & 0x1F));
+        case U_OR: case U_ORI: return a | b;
+        case U_AND: case U_ANDI: return a & b;
+        case U_MUL: return a * b;
+        case U_MULH: return MULH(a, b);
+        case U_MULHSU: return MULHSU(a, b);
+        case U_MULHU: return MULHU(a, b);
+        case U_DIV: return DIV(a, b);
+        case U_DIVU: return DIVU(a, b);
+        case U_REM: return REM(a, b);
+        case U_REMU: return REMU(a, b);
+    }
+    return 0;
+}
+
+//Lifts consecutive decoded instructions starting at start_pc; the last one may be a branch or jump
+inline std::vector<Uop> Ir_Lift(const std::vector<Decoded_Instruction>& insts, uint32_t start_pc){
+    std::vector<Uop> uops;
+    uint32_t pc = start_pc;
+
+    for(uint32_t i = 0; i < insts.size(); pc += INST_LENGTH(insts[i].raw), i++){
+        const Decoded_Instruction& in = insts[i];
+        Uop u = {0, in.rd, in.rs1, in.rs2, (uint32_t)in.imm, pc + INST_LENGTH(in.raw), i};
+
+        switch(in.op){
+            case OP_LUI: u.kind = U_LI; break;
+            case OP_AUIPC: u.kind = U_LI; u.imm = pc + in.imm; break;
+            case OP_ADD: u.kind = U_ADD; break;
+            case OP_SUB: u.kind = U_SUB; break;
+            case OP_SLL: u.kind = U_SLL; break;
+            case OP_SLT: u.kind = U_SLT; break;
+            case OP_SLTU: u.kind = U_SLTU; break;
+            case OP_XOR: u.kind = U_XOR; break;
+            case OP_SRL: u.kind = U_SRL; break;
+            case OP_SRA: u.kind = U_SRA; break;
+            case OP_OR: u.kind = U_OR; break;
+            case OP_AND: u.kind = U_AND; break;
+            case OP_MUL: case OP_MULH: case OP_MULHSU: case OP_MULHU: case OP_DIV: case OP_DIVU: case OP_REM: case OP_REMU:
+                u.kind = U_MUL + (in.op - OP_MUL);
+                break;
+            case OP_ADDI: u.kind = U_ADDI; break;
+            case OP_SLTI: u.kind = U_SLTI; break;
+            case OP_SLTIU: u.kind = U_SLTIU; break;
+            case OP_XORI: u.kind = U_XORI; break;
+            case OP_ORI: u.kind = U_ORI; break;
+            case OP_ANDI: u.kind = U_ANDI; break;
+            case OP_SLLI: u.kind = U_SLLI; u.imm &= 0x1F; break;
+            case OP_SRLI: u.kind = U_SRLI; u.imm &= 0x1F; break;
+            case OP_SRAI: u.kind = U_SRAI; u.imm &= 0x1F; break;
+            case OP_LB: u.kind = U_LB; break;
+            case OP_LH: u.kind = U_LH; break;
+            case OP_LW: u.kind = U_LW; break;
+            case OP_LBU: u.kind = U_LBU; break;
+            case OP_LHU: u.kind = U_LHU; break;
+            case OP_SB: u.kind = U_SB; break;
+            case OP_SH: u.kind = U_SH; break;
+            case OP_SW: u.kind = U_SW; break;
+            case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BGE: case OP_BLTU: case OP_BGEU:
+                u.kind = U_BEQ + (in.op - OP_BEQ);
+                u.imm = pc + in.imm;
+                break;
+            case OP_JAL: u.kind = U_JAL; u.imm = pc + in.imm; break;
+            case OP_JALR: u.kind = U_JALR; break;
+            default: continue;  //The block builder never hands us anything else
+        }
+        uops.push_back(u);
+    }
+
+    if(uops.empty() || uops.back().kind < U_BEQ){
+        Uop end = {U_EXIT, 0, 0, 0, pc, 0, (uint32_t)insts.size() - 1};
+        uops.push_back(end);
+    }
+    return uops;
+}
+
+//Constant propagation: folds ops whose inputs are known (LUI/AUIPC + ADDI pairs become one LI)
+//and turns reg-reg ops with a constant second operand into their immediate form.
+inline void Ir_Fold_Constants(std::vector<Uop>& uops){
+    bool known[32] = {true};
+    uint32_t value[32] = {0};
+
+    for(Uop& u : uops){
+        if(Uop_Pure(u.kind) && u.kind != U_LI){
+            bool reg_reg = Uop_Reg_Reg(u.kind);
+            if(known[u.rs1] && (!reg_reg || known[u.rs2])){
+                u.imm = Uop_Eval(u.kind, value[u.rs1], reg_reg ? value[u.rs2] : u.imm);
+                u.kind = U_LI;
+            }
+            else if(reg_reg && known[u.rs2] && u.kind != U_SUB && u.kind <= U_AND){   //RV32M has no immediate forms
+                static const uint8_t imm_form[] = {0, U_ADDI, 0, U_SLLI, U_SLTI, U_SLTIU, U_XORI, U_SRLI, U_SRAI, U_ORI, U_ANDI};
+                u.imm = value[u.rs2];
+                if(u.kind == U_SLL || u.kind == U_SRL || u.kind == U_SRA) u.imm &= 0x1F;
+                u.kind = imm_form[u.kind];
+            }
+        }
+
+        if(u.rd == 0) continue;
+        if(Uop_Pure(u.kind)){
+            known[u.rd] = u.kind == U_LI;
+            value[u.rd] = u.imm;
+        }
+        else if(u.kind <= U_LHU || u.kind == U_JAL || u.kind == U_JALR){ //Loads; links are never read inside the block
+            known[u.rd] = false;
+        }
+    }
+}
+
+//Drops pure ops that write x0 and pure writes that are overwritten before anything reads them.
+//Registers must be exact wherever the block can stop early, so loads and stores end the window.
+inline void Ir_Eliminate_Dead_Writes(std::vector<Uop>& uops){
+    bool dead[32] = {false};
+    std::vector<Uop> kept;
+
+    for(size_t n = uops.size(); n-- > 0;){
+        Uop& u = uops[n];
+
+        if(Uop_Pure(u.kind)){
+            if(u.rd == 0 || dead[u.rd]) continue;
+            dead[u.rd] = true;
+            if(u.kind != U_LI) dead[u.rs1] = false;
+            if(Uop_Reg_Reg(u.kind)) dead[u.rs2] = false;
+        }
+        else if(Uop_Memory(u.kind)){
+            for(auto& d : dead) d = false;
+            if(u.kind <= U_LHU) dead[u.rd] = u.rd != u.rs1;
+        }
+        else{   //Terminator: everything is live after it, it reads rs1/rs2
+            for(auto& d : dead) d = false;
+        }
+        kept.push_back(u);
+    }
+
+    uops.assign(kept.rbegin(), kept.rend());
+}
+
+//Compare-and-branch fusion: "slt t, a, b; bnez t" branches on a < b directly (likewise sltu,
+//and sub/xor feeding beqz/bnez), as long as a and b are unchanged in between.
+inline void Ir_Fuse_Branch(std::vector<Uop>& uops){
+    Uop& br = uops.back();
+    if((br.kind != U_BEQ && br.kind != U_BNE) || br.rs2 != 0 || br.rs1 == 0) return;
+
+    for(size_t n = uops.size() - 1; n-- > 0;){
+        const Uop& u = uops[n];
+        if(Uop_Memory(u.kind)) return;
+        if(u.rd != br.rs1) continue;
+        if(u.rs1 == u.rd || (Uop_Reg_Reg(u.kind) && u.rs2 == u.rd)) return;   //Op overwrote its own input
+
+        for(size_t k = n + 1; k + 1 < uops.size(); k++){    //Operands must survive until the branch
+            if(uops[k].rd == u.rs1 || uops[k].rd == u.rs2) return;
+        }
+
+        bool nez = br.kind == U_BNE;
+        switch(u.kind){
+            case U_SLT: br.kind = nez ? U_BLT : U_BGE; break;
+            case U_SLTU: br.kind = nez ? U_BLTU : U_BGEU; break;
+            case U_SUB: case U_XOR: br.kind = nez ? U_BNE : U_BEQ; break;
+            default: return;
+        }
+        br.rs1 = u.rs1;
+        br.rs2 = u.rs2;
+        return;
+    }
+}
+
+inline void Ir_Optimize(std::vector<Uop>& uops){
+    Ir_Fold_Constants(uops);
+    Ir_Fuse_Branch(uops);
+    Ir_Eliminate_Dead_Writes(uops);
+}
@@ -0,0 +1,286 @@
+#pragma once
+//Branch prediction models. A Branch_Unit<Direction> is the front end of a simple in-order core:
+//a direction policy for conditional branches, a BTB holding the targets of taken branches and
+//jumps, and a return address stack. Each control transfer compares where that front end would
+//have fetched next against where control really went; a mismatch costs BRANCH_PENALTY cycles.
+//The cores are templates over the unit type, so with No_Predictor none of this is compiled in.
+#include<cstdint>
+#include<cstring>
+
+#include "snapshot.h"
+
+enum Predictor_Kind{ BP_NONE, BP_BIMODAL, BP_GSHARE, BP_TAGE };
+static const char* const PREDICTOR_NAMES[] = {"none", "bimodal", "gshare", "tage"};
+
+static const uint32_t BRANCH_PENALTY = 2;   //Pipeline flush after a mispredicted control transfer
+static const uint32_t BTB_BITS = 9;
+static const uint32_t RAS_SIZE = 16;
+
+struct Branch_Stats{
+    uint64_t branches = 0;  //Conditional branches
+    uint64_t direction_misses = 0;
+    uint64_t jumps = 0; //JAL and JALR, returns excluded
+    uint64_t target_misses = 0; //Predicted-taken branches and jumps without the right BTB target
+    uint64_t returns = 0;
+    uint64_t return_misses = 0;
+    uint64_t mispredicts = 0;   //Everything that paid BRANCH_PENALTY
+
+    void Add(const Branch_Stats& other){
+        branches += other.branches;
+        direction_misses += other.direction_misses;
+        jumps += other.jumps;
+        target_misses += other.target_misses;
+        returns += other.returns;
+        return_misses += other.return_misses;
+        mispredicts += other.mispredicts;
+    }
+};
+
+inline void Counter_Update(uint8_t& counter, bool taken){   //2-bit saturating counter
+    if(taken){
+        if(counter < 3) counter++;
+    }
+    else{
+        if(counter > 0) counter--;
+    }
+}
+
+//Direction policies: Predict(pc) is always followed by Update(pc, taken) for the same branch
+
+struct Bimodal_Policy{  //4096 2-bit counters indexed by PC
+    uint8_t table[4096];
+
+    Bimodal_Policy(){ std::memset(table, 1, sizeof(table)); }
+
+    bool Predict(uint32_t pc){ return table[(pc >> 2) & 0xFFF] >= 2; }
+    void Update(uint32_t pc, bool taken){ Counter_Update(table[(pc >> 2) & 0xFFF], taken); }
+};
+
+struct Gshare_Policy{   //2-bit counters indexed by PC xor the last 12 branch outcomes
+    uint8_t table[4096];
+    uint32_t history = 0;
+
+    Gshare_Policy(){ std::memset(table, 1, sizeof(table)); }
+
+    uint32_t Index(uint32_t pc){ return ((pc >> 2) ^ history) & 0xFFF; }
+    bool Predict(uint32_t pc){ return table[Index(pc)] >= 2; }
+    void Update(uint32_t pc, bool taken){
+        Counter_Update(table[Index(pc)], taken);
+        history = ((history << 1) | taken) & 0xFFF;
+    }
+};
+
+//TAGE-lite: a bimodal base plus four tagged tables looked up with geometrically longer global
+//histories. The longest matching table predicts; mispredictions allocate in a longer one.
+struct Tage_Policy{
+    static const int TABLES = 4;
+    static const uint32_t INDEX_BITS = 10;
+    static const uint32_t TAG_BITS = 9;
+
+    struct Entry{
+        uint16_t tag;   //0 = empty
+        int8_t counter;  //-4 .. 3, taken if >= 0
+        uint8_t useful;  //0 .. 3
+    };
+
+    uint8_t base[4096];
+    Entry tables[TABLES][1 << INDEX_BITS];
+    uint64_t history = 0;
+    uint32_t ticks = 0; //Useful bits age every 256K updates
+
+    //Lookup of the last Predict, reused by Update
+    uint32_t index[TABLES];
+    uint16_t tag[TABLES];
+    int provider;   //Longest matching table, -1 = base
+    bool provider_guess, alt_guess;
+
+    Tage_Policy(){
+        std::memset(base, 1, sizeof(base));
+        std::memset(tables, 0, sizeof(tables));
+    }
+
+    static uint32_t Fold(uint64_t bits, uint32_t length, uint32_t width){   //XOR-folds the newest length bits to width bits
+        if(length < 64) bits &= (1ull << length) - 1;
+        uint32_t out = 0;
+        for(; bits; bits >>= width) out ^= (uint32_t)bits & ((1u << width) - 1);
+        return out;
+    }
+
+    bool Predict(uint32_t pc){
+        static const uint32_t lengths[TABLES] = {5, 11, 23, 47};
+        uint32_t word = pc >> 2;
+
+        bool guess = base[word & 0xFFF] >= 2;
+        provider = -1;
+        provider_guess = alt_guess = guess;
+        for(int t = 0; t < TABLES; t++){
+            index[t] = (word ^ (word >> INDEX_BITS) ^ Fold(history, lengths[t], INDEX_BITS)) & ((1u << INDEX_BITS) - 1);
+            tag[t] = (uint16_t)(((word ^ (Fold(history, lengths[t], TAG_BITS) << 1)) & ((1u << TAG_BITS) - 1)) + 1);
+
+            if(tables[t][index[t]].tag == tag[t]){
+                alt_guess = provider_guess;
+                provider_guess = tables[t][index[t]].counter >= 0;
+                provider = t;
+            }
+        }
+        return provider_guess;
+    }
+
+    void Update(uint32_t pc, bool taken){
+        if(provider >= 0){
+            Entry& e = tables[provider][index[provider]];
+            if(taken && e.counter < 3) e.counter++;
+            if(!taken && e.counter > -4) e.counter--;
+            if(provider_guess != alt_guess){
+                if(provider_guess == taken && e.useful < 3) e.useful++;
+                if(provider_guess != taken && e.useful > 0) e.useful--;
+            }
+        }
+        else Counter_Update(base[(pc >> 2) & 0xFFF], taken);
+
+        if(provider_guess != taken && provider < TABLES - 1){   //Allocate in the first longer table with a free entry
+            bool allocated = false;
+            for(int t = provider + 1; t < TABLES && !allocated; t++){
+                Entry& e = tables[t][index[t]];
+                if(e.useful == 0){
+                    e.tag = tag[t];
+                    e.counter = taken ? 0 : -1;
+                    allocated = true;
+                }
+            }
+            for(int t = provider + 1; t < TABLES && !allocated; t++){
+                if(tables[t][index[t]].useful > 0) tables[t][index[t]].useful--;
+            }
+        }
+
+        if((++ticks & 0x3FFFF) == 0){
+            for(auto& table : tables){
+                for(auto& e : table) e.useful >>= 1;
+            }
+        }
+        history = (history << 1) | taken;
+    }
+};
+
+struct Branch_Model{    //What a hart owns; the cores cast it back to the unit type they were built for
+    Predictor_Kind kind = BP_NONE;
+    Branch_Stats stats;
+
+    virtual ~Branch_Model(){}
+    virtual void Save(Snapshot_Out& out) = 0;
+    virtual bool Load(Snapshot_In& in) = 0;
+};
+
+struct No_Predictor : Branch_Model{ //--bpred=none: the cores skip every call below at compile time
+    static const bool ENABLED = false;
+
+    bool Branch(uint32_t, bool, uint32_t){ return false; }
+    bool Jump(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t){ return false; }
+    void Save(Snapshot_Out&) override {}
+    bool Load(Snapshot_In&) override { return true; }
+};
+
+template<typename Direction> struct Branch_Unit : Branch_Model{
+    static const bool ENABLED = true;
+
+    struct Btb_Entry{
+        uint32_t pc;
+        uint32_t target;
+    };
+
+    Direction direction;
+    Btb_Entry btb[1 << BTB_BITS];   //Direct mapped, pc 1 marks an empty entry
+    uint32_t ras[RAS_SIZE] = {};
+    uint32_t ras_top = 0;   //Circular: deep call chains overwrite the oldest return addresses
+    uint32_t ras_count = 0;
+
+    Branch_Unit(){
+        for(auto& entry : btb) entry = {1, 0};
+    }
+
+    Btb_Entry& Btb_Slot(uint32_t pc){ return btb[(pc >> 2) & ((1u << BTB_BITS) - 1)]; }
+
+    bool Btb_Hit(uint32_t pc, uint32_t target){
+        Btb_Entry& entry = Btb_Slot(pc);
+        return entry.pc == pc && entry.target == target;
+    }
+
+    //Conditional branch at pc; true if the front end fetched the wrong path
+    bool Branch(uint32_t pc, bool taken, uint32_t target){
+        stats.branches++;
+        bool guess = direction.Predict(pc);
+        direction.Update(pc, taken);
+        if(guess != taken) stats.direction_misses++;
+
+        bool miss = guess != taken;
+        if(taken){
+            if(guess && !Btb_Hit(pc, target)){
+                stats.target_misses++;
+                miss = true;
+            }
+            Btb_Slot(pc) = {pc, target};
+        }
+        stats.mispredicts += miss;
+        return miss;
+    }
+
+    //JAL (rs1 = 0) or JALR at pc, link the address after it. x1/x5 as rd push link as the return
+    //address, as rs1 (and not the same register as rd) they pop one, following the RISC-V hints.
+    bool Jump(uint32_t pc, uint32_t link, uint32_t target, uint32_t rd, uint32_t rs1){
+        bool rd_link = rd == 1 || rd == 5;
+        bool rs1_link = rs1 == 1 || rs1 == 5;
+
+        bool miss;
+        if(rs1_link && rd != rs1){
+            stats.returns++;
+            miss = ras_count == 0 || ras[(ras_top + RAS_SIZE - 1) % RAS_SIZE] != target;
+            if(ras_count){
+                ras_top = (ras_top + RAS_SIZE - 1) % RAS_SIZE;
+                ras_count--;
+            }
+            stats.return_misses += miss;
+        }
+        else{
+            stats.jumps++;
+            miss = !Btb_Hit(pc, target);
+            stats.target_misses += miss;
+            Btb_Slot(pc) = {pc, target};
+        }
+
+        if(rd_link){
+            ras[ras_top] = link;
+            ras_top = (ras_top + 1) % RAS_SIZE;
+            if(ras_count < RAS_SIZE) ras_count++;
+        }
+        stats.mispredicts += miss;
+        return miss;
+    }
+
+    void Save(Snapshot_Out& out) override {
+        out.Put(direction);
+        out.Put(btb);
+        out.Put(ras);
+        out.Put(ras_top);
+        out.Put(ras_count);
+        out.Put(stats);
+    }
+
+    bool Load(Snapshot_In& in) override {
+        return in.Get(direction) && in.Get(btb) && in.Get(ras) && in.Get(ras_top) && in.Get(ras_count)
+            && in.Get(stats) && ras_top < RAS_SIZE && ras_count <= RAS_SIZE;
+    }
+};
+
+typedef Branch_Unit<Bimodal_Policy> Bimodal_Unit;
+typedef Branch_Unit<Gshare_Policy> Gshare_Unit;
+typedef Branch_Unit<Tage_Policy> Tage_Unit;
+
+inline Branch_Model* Make_Predictor(Predictor_Kind kind){
+    Branch_Model* model;
+    if(kind == BP_BIMODAL) model = new Bimodal_Unit();
+    else if(kind == BP_GSHARE) model = new Gshare_Unit();
+    else if(kind == BP_TAGE) model = new Tage_Unit();
+    else model = new No_Predictor();
+    model->kind = kind;
+    return model;
+}
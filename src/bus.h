@@ -0,0 +1,63 @@
+#pragma once
+//Memory-mapped device bus. Devices claim address ranges; the memory accessors only consult
+//the bus for pages marked PAGE_MMIO, so plain DRAM accesses never pay for device lookups.
+#include<cstdint>
+#include<vector>
+
+struct Device{
+    virtual ~Device(){}
+
+    //hart is the mhartid of the accessing hart. Return false to decline an access (unknown
+    //register or width); it then goes to DRAM as usual
+    virtual bool Read(uint32_t hart, uint32_t addr, uint32_t size, uint32_t& val) = 0;
+    virtual bool Write(uint32_t hart, uint32_t addr, uint32_t size, uint32_t val) = 0;
+};
+
+struct Bus_Mapping{
+    uint32_t start;
+    uint32_t end;   //Exclusive
+    Device* device;
+};
+
+struct Mmio_Bus{
+    std::vector<Bus_Mapping> mappings;  //Sorted by start, never overlapping
+
+    ~Mmio_Bus(){
+        for(auto& m : mappings) delete m.device;
+    }
+
+    bool Attach(uint32_t start, uint32_t size, Device* device){ //Takes ownership of device
+        uint32_t end = start + size;
+        size_t i = 0;
+        while(i < mappings.size() && mappings[i].start < start) i++;
+
+        if((i > 0 && mappings[i - 1].end > start) || (i < mappings.size() && mappings[i].start < end)){
+            delete device;  //Overlaps a device that is already mapped
+            return false;
+        }
+
+        mappings.insert(mappings.begin() + i, Bus_Mapping{start, end, device});
+        return true;
+    }
+
+    Device* Find(uint32_t addr){
+        size_t lo = 0, hi = mappings.size();
+        while(lo < hi){ //Binary search for the last mapping starting at or below addr
+            size_t mid = (lo + hi) / 2;
+            if(mappings[mid].start <= addr) lo = mid + 1;
+            else hi = mid;
+        }
+        if(lo == 0 || addr >= mappings[lo - 1].end) return nullptr;
+        return mappings[lo - 1].device;
+    }
+
+    bool Read(uint32_t hart, uint32_t addr, uint32_t size, uint32_t& val){
+        Device* device = Find(addr);
+        return device && device->Read(hart, addr, size, val);
+    }
+
+    bool Write(uint32_t hart, uint32_t addr, uint32_t size, uint32_t val){
+        Device* device = Find(addr);
+        return device && device->Write(hart, addr, size, val);
+    }
+};
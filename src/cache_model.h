@@ -0,0 +1,199 @@
+#pragma once
+//Cache timing model (--cache). Every hart gets a private L1I, L1D and L2 in front of DRAM; only
+//tags are simulated, data always comes from guest RAM. An access costs the latency of the first
+//level that hits (memory_latency if none does) on top of the 1 cycle per instruction, and misses
+//fill every level on the way. Writes allocate like reads. MMIO bypasses the caches.
+//
+//Tags live in flat per-level arrays (set * ways + way), so an access is one short scan and
+//never allocates.
+#include<cstdint>
+#include<cstdlib>
+#include<string>
+#include<vector>
+
+enum Cache_Level_Id{ CACHE_L1I, CACHE_L1D, CACHE_L2, CACHE_LEVELS };
+static const char* const CACHE_LEVEL_NAMES[CACHE_LEVELS] = {"l1i", "l1d", "l2"};
+
+enum Replacement{ REPLACE_LRU, REPLACE_FIFO, REPLACE_RANDOM };
+static const char* const REPLACEMENT_NAMES[] = {"lru", "fifo", "random"};
+static const uint32_t CACHE_EMPTY_LINE = 0xFFFFFFFF;  //Line addresses are at most 0xFFFFFFFF >> 2
+
+struct Cache_Config{
+    uint32_t size;  //Bytes, 0 = level absent
+    uint32_t ways;
+    uint32_t line;
+    uint32_t latency;   //Extra cycles when this level hits
+    Replacement policy;
+};
+
+struct Cache_Setup{ //What the --cache options describe
+    bool enabled = false;
+    Cache_Config levels[CACHE_LEVELS] = {
+        {16 * 1024, 4, 64, 0, REPLACE_LRU},
+        {16 * 1024, 4, 64, 0, REPLACE_LRU},
+        {256 * 1024, 8, 64, 12, REPLACE_LRU},
+    };
+    uint32_t memory_latency = 80;
+};
+
+struct Cache_Level{
+    Cache_Config config = {};
+    uint32_t line_shift = 0;
+    uint32_t set_mask = 0;
+    std::vector<uint32_t> lines;    //Line address per way, CACHE_EMPTY_LINE if invalid
+    std::vector<uint64_t> stamps;   //LRU: last use, FIFO: fill order
+    uint64_t clock = 0;
+    uint32_t random = 0x2545F491;
+    uint32_t last_line = CACHE_EMPTY_LINE;    //Most recent hit or fill: already MRU, skip the scan
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    bool Present() const { return config.size != 0; }
+
+    void Init(const Cache_Config& c){
+        config = c;
+        if(!Present()) return;
+        while((1u << line_shift) < c.line) line_shift++;
+        uint32_t sets = c.size / (c.ways * c.line);
+        set_mask = sets - 1;
+        lines.assign((size_t)sets * c.ways, CACHE_EMPTY_LINE);
+        stamps.assign((size_t)sets * c.ways, 0);
+    }
+
+    bool Access(uint32_t addr){ //True on a hit; a miss fills the line
+        uint32_t line = addr >> line_shift;
+        if(line == last_line){
+            hits++;
+            return true;
+        }
+        last_line = line;
+
+        size_t base = (size_t)(line & set_mask) * config.ways;
+        uint32_t* set = &lines[base];
+        for(uint32_t w = 0; w < config.ways; w++){
+            if(set[w] == line){
+                hits++;
+                if(config.policy == REPLACE_LRU) stamps[base + w] = ++clock;
+                return true;
+            }
+        }
+
+        misses++;
+        uint32_t victim = 0;
+        if(config.policy == REPLACE_RANDOM){
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            victim = random % config.ways;
+        }
+        for(uint32_t w = 0; w < config.ways; w++){  //Free ways first, then the oldest stamp
+            if(set[w] == CACHE_EMPTY_LINE){
+                victim = w;
+                break;
+            }
+            if(config.policy != REPLACE_RANDOM && stamps[base + w] < stamps[base + victim]) victim = w;
+        }
+        set[victim] = line;
+        stamps[base + victim] = ++clock;
+        return false;
+    }
+};
+
+struct Cache_Hierarchy{
+    Cache_Level levels[CACHE_LEVELS];
+    uint32_t memory_latency = 0;
+    uint32_t worst_miss = 0;    //Most an access can cost, for Fetch_Bound
+
+    explicit Cache_Hierarchy(const Cache_Setup& setup){
+        for(int i = 0; i < CACHE_LEVELS; i++) levels[i].Init(setup.levels[i]);
+        memory_latency = setup.memory_latency;
+        worst_miss = memory_latency;
+        for(const auto& level : levels){
+            if(level.Present() && level.config.latency > worst_miss) worst_miss = level.config.latency;
+        }
+    }
+
+    uint32_t Lower(uint32_t addr){  //L1 missed
+        Cache_Level& l2 = levels[CACHE_L2];
+        if(l2.Present() && l2.Access(addr)) return l2.config.latency;
+        return memory_latency;
+    }
+
+    uint32_t Access(Cache_Level_Id id, uint32_t addr){  //Extra cycles for one fetch or data access
+        Cache_Level& l1 = levels[id];
+        if(!l1.Present()) return Lower(addr);
+        if(l1.Access(addr)) return l1.config.latency;
+        return Lower(addr);
+    }
+
+    uint32_t Fetch(uint32_t pc){ return Access(CACHE_L1I, pc); }
+    uint32_t Data(uint32_t addr){ return Access(CACHE_L1D, addr); }
+
+    //Most cycles fetching count straight-line instructions can add, so the block cores can tell
+    //whether an event may fall due inside a block
+    uint64_t Fetch_Bound(uint32_t count) const {
+        const Cache_Level& l1 = levels[CACHE_L1I];
+        if(!l1.Present()) return (uint64_t)count * worst_miss;
+        uint64_t lines = ((uint64_t)count * 4 >> l1.line_shift) + 2;
+        if(lines > count) lines = count;
+        return (uint64_t)count * l1.config.latency + lines * worst_miss;
+    }
+};
+
+inline bool Cache_Power_Of_Two(uint32_t value){ return value && !(value & (value - 1)); }
+
+inline bool Cache_Parse_Number(const std::string& text, uint32_t& value){
+    char* end = nullptr;
+    unsigned long long number = std::strtoull(text.c_str(), &end, 0);
+    if(end == text.c_str()) return false;
+    if(*end == 'K' || *end == 'k'){ number <<= 10; end++; }
+    else if(*end == 'M' || *end == 'm'){ number <<= 20; end++; }
+    if(*end != '\0' || number > 0x80000000ull) return false;
+    value = (uint32_t)number;
+    return true;
+}
+
+//One --cache option: empty (defaults), LEVEL:off, LEVEL:SIZE:WAYS:LINE:LATENCY[:lru|fifo|random]
+//or mem:LATENCY. Every use turns the model on.
+inline bool Parse_Cache_Option(const std::string& text, Cache_Setup& setup){
+    setup.enabled = true;
+    if(text.empty()) return true;
+
+    std::vector<std::string> fields;
+    for(size_t start = 0;;){
+        size_t colon = text.find(':', start);
+        fields.push_back(text.substr(start, colon - start));
+        if(colon == std::string::npos) break;
+        start = colon + 1;
+    }
+
+    if(fields[0] == "mem") return fields.size() == 2 && Cache_Parse_Number(fields[1], setup.memory_latency);
+
+    int id = 0;
+    while(id < CACHE_LEVELS && fields[0] != CACHE_LEVEL_NAMES[id]) id++;
+    if(id == CACHE_LEVELS) return false;
+    Cache_Config& level = setup.levels[id];
+
+    if(fields.size() == 2 && fields[1] == "off"){
+        level.size = 0;
+        return true;
+    }
+    if(fields.size() != 5 && fields.size() != 6) return false;
+
+    Cache_Config c = {};
+    if(!Cache_Parse_Number(fields[1], c.size) || !Cache_Parse_Number(fields[2], c.ways)
+        || !Cache_Parse_Number(fields[3], c.line) || !Cache_Parse_Number(fields[4], c.latency)) return false;
+
+    c.policy = REPLACE_LRU;
+    if(fields.size() == 6){
+        int policy = 0;
+        while(policy <= REPLACE_RANDOM && fields[5] != REPLACEMENT_NAMES[policy]) policy++;
+        if(policy > REPLACE_RANDOM) return false;
+        c.policy = (Replacement)policy;
+    }
+
+    if(!Cache_Power_Of_Two(c.size) || !Cache_Power_Of_Two(c.ways) || !Cache_Power_Of_Two(c.line)
+        || c.line < 4 || c.ways > 64 || c.size < c.ways * c.line) return false;
+    level = c;
+    return true;
+}
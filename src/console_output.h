@@ -0,0 +1,136 @@
+#pragma once
+//Buffered console output: UART bytes, write ecalls, breakpoint messages and trace dumps. Every hart
+//has a ring of its own, so it is the only producer and a byte costs a store and an index bump, no
+//lock and no syscall. A host I/O thread is the consumer and writes the rings to the console stream:
+//at once after a newline or CONSOLE_FLUSH_SIZE bytes, otherwise within CONSOLE_FLUSH_MS, so a
+//prompt without a newline still shows up. Flush() writes everything out on the caller's thread;
+//exit, faults and anything that writes to the stream itself call it first to keep the order.
+//
+//Without Start() there is no thread and every write goes straight to the stream; batch jobs print
+//into a string, where buffering hides nothing.
+#include<algorithm>
+#include<atomic>
+#include<chrono>
+#include<condition_variable>
+#include<cstdint>
+#include<cstring>
+#include<memory>
+#include<mutex>
+#include<ostream>
+#include<string>
+#include<thread>
+#include<vector>
+
+static const uint32_t CONSOLE_RING_SIZE = 1 << 16;  //Bytes per hart, a power of two
+static const uint32_t CONSOLE_FLUSH_SIZE = 4096;    //Wake the I/O thread once this much is waiting
+static const int CONSOLE_FLUSH_MS = 10; //Longest a byte waits without a newline
+
+struct Console_Ring{    //One hart's output on its way to the stream
+    char data[CONSOLE_RING_SIZE];
+    std::atomic<uint32_t> head{0};  //Next byte the hart writes; both indices run freely and wrap
+    std::atomic<uint32_t> tail{0};  //Next byte that goes to the stream
+    uint32_t woken = 0; //Hart side: head when it last woke the I/O thread
+};
+
+struct Console_Output{
+    std::ostream* out;
+    std::vector<std::unique_ptr<Console_Ring>> rings;   //Indexed by mhartid
+    std::mutex stream_mutex;    //Held while writing to out: the I/O thread, Flush and the unbuffered path
+    std::mutex wait_mutex;
+    std::condition_variable wake;
+    std::atomic<bool> wake_pending{false};
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+
+    explicit Console_Output(std::ostream& out) : out(&out) {}
+    ~Console_Output(){ Stop(); }
+
+    //Buffers harts' output from here on and starts the I/O thread; call before the harts run
+    void Start(uint32_t harts){
+        rings.clear();
+        for(uint32_t i = 0; i < harts; i++) rings.emplace_back(new Console_Ring());
+        stopping = false;
+        thread = std::thread(&Console_Output::Run, this);
+    }
+
+    void Stop(){    //Joins the I/O thread and writes out what is left
+        if(!thread.joinable()) return;
+        stopping = true;
+        Wake();
+        thread.join();
+        Flush();
+        rings.clear();
+    }
+
+    void Write(uint32_t hart, const char* bytes, uint32_t size){
+        if(rings.empty()){
+            std::lock_guard<std::mutex> lock(stream_mutex);
+            out->write(bytes, size);
+            out->flush();
+            return;
+        }
+
+        Console_Ring& ring = *rings[hart];
+        uint32_t head = ring.head.load(std::memory_order_relaxed);
+        bool newline = std::memchr(bytes, '\n', size) != nullptr;
+        while(size > 0){
+            uint32_t space = CONSOLE_RING_SIZE - (head - ring.tail.load(std::memory_order_acquire));
+            if(space == 0){ //Full: the I/O thread is behind, hand it the ring and wait
+                Wake();
+                std::this_thread::yield();
+                continue;
+            }
+            uint32_t chunk = std::min({size, space, CONSOLE_RING_SIZE - (head & (CONSOLE_RING_SIZE - 1))});
+            std::memcpy(&ring.data[head & (CONSOLE_RING_SIZE - 1)], bytes, chunk);
+            head += chunk;
+            bytes += chunk;
+            size -= chunk;
+            ring.head.store(head, std::memory_order_release);
+        }
+        if(newline || head - ring.woken >= CONSOLE_FLUSH_SIZE){
+            ring.woken = head;
+            Wake();
+        }
+    }
+
+    void Put(uint32_t hart, char c){ Write(hart, &c, 1); }
+    void Write(uint32_t hart, const std::string& text){ Write(hart, text.data(), (uint32_t)text.size()); }
+
+    void Flush(){   //Everything written so far reaches the stream before this returns
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        Drain();
+    }
+
+private:
+    void Wake(){
+        if(wake_pending.exchange(true, std::memory_order_acq_rel)) return;  //Already on its way
+        wake.notify_one();
+    }
+
+    void Drain(){   //Caller holds stream_mutex, which makes it the only consumer
+        bool wrote = false;
+        for(auto& ring : rings){
+            uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+            uint32_t head = ring->head.load(std::memory_order_acquire);
+            while(tail != head){
+                uint32_t chunk = std::min(head - tail, CONSOLE_RING_SIZE - (tail & (CONSOLE_RING_SIZE - 1)));
+                out->write(&ring->data[tail & (CONSOLE_RING_SIZE - 1)], chunk);
+                tail += chunk;
+                ring->tail.store(tail, std::memory_order_release);
+                wrote = true;
+            }
+        }
+        if(wrote) out->flush();
+    }
+
+    void Run(){ //The I/O thread. A wake-up that slips in between the check and the wait costs one CONSOLE_FLUSH_MS.
+        while(!stopping){
+            {
+                std::unique_lock<std::mutex> lock(wait_mutex);
+                wake.wait_for(lock, std::chrono::milliseconds(CONSOLE_FLUSH_MS), [this]{ return wake_pending.load(); });
+            }
+            wake_pending = false;
+            Flush();
+        }
+    }
+};
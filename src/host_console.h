@@ -0,0 +1,161 @@
+#pragma once
+//UART input. A host reader thread moves bytes from stdin (a terminal, switched to raw mode for the
+//run, a pipe or a file) or from --uart-in=FILE into a lock-free RX FIFO, so polling the UART status
+//register is a load of the FIFO indices and never a system call. The reader is the only producer;
+//harts take bytes with a compare-and-swap on the tail, so several may read the UART at once.
+//Windows has no poll() on a console, there the reader polls _kbhit/_getch from <conio.h>.
+#include<algorithm>
+#include<atomic>
+#include<cstdint>
+#include<cstdlib>
+#include<functional>
+#include<string>
+#include<thread>
+#ifdef _WIN32
+#include<chrono>
+#include<conio.h>
+#else
+#include<cerrno>
+#include<csignal>
+#include<fcntl.h>
+#include<poll.h>
+#include<termios.h>
+#include<unistd.h>
+#endif
+
+static const uint32_t CONSOLE_FIFO_SIZE = 4096; //Bytes read ahead, a power of two
+
+#ifndef _WIN32
+static struct termios console_saved_mode;   //Terminal settings before raw mode, put back at exit
+static std::atomic<bool> console_raw{false};
+
+inline void Console_Restore_Mode(){
+    if(console_raw.exchange(false)) tcsetattr(STDIN_FILENO, TCSANOW, &console_saved_mode);
+}
+
+inline void Console_Signal(int sig){    //Ctrl-C and friends: leave the terminal usable, then die as usual
+    Console_Restore_Mode();
+    std::signal(sig, SIG_DFL);
+    std::raise(sig);
+}
+#endif
+
+struct Console_Input{
+    char data[CONSOLE_FIFO_SIZE];
+    std::atomic<uint32_t> head{0};  //Next byte the reader stores; both indices run freely and wrap
+    std::atomic<uint32_t> tail{0};  //Next byte a hart takes
+    std::function<void()> received; //Called on the reader thread after new bytes land
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+#ifndef _WIN32
+    int fd = -1;
+    bool own_fd = false;
+    int stop_pipe[2] = {-1, -1};    //Written by Stop to wake the reader out of poll()
+#endif
+
+    ~Console_Input(){ Stop(); }
+
+    bool Available() const {
+        return head.load(std::memory_order_acquire) != tail.load(std::memory_order_relaxed);
+    }
+
+    bool Take(uint8_t& byte){   //Oldest byte, false if the FIFO is empty
+        uint32_t at = tail.load(std::memory_order_relaxed);
+        for(;;){
+            if(at == head.load(std::memory_order_acquire)) return false;
+            byte = (uint8_t)data[at & (CONSOLE_FIFO_SIZE - 1)];
+            if(tail.compare_exchange_weak(at, at + 1, std::memory_order_release, std::memory_order_relaxed)) return true;
+        }
+    }
+
+    //Starts reading path, or stdin if it is empty. False if the file cannot be opened.
+    bool Start(const std::string& path){
+#ifdef _WIN32
+        if(!path.empty()) return false;
+        thread = std::thread(&Console_Input::Run_Conio, this);
+        return true;
+#else
+        own_fd = !path.empty();
+        fd = own_fd ? open(path.c_str(), O_RDONLY) : STDIN_FILENO;
+        if(fd < 0 || pipe(stop_pipe) != 0){
+            if(own_fd && fd >= 0) close(fd);
+            fd = -1;
+            return false;
+        }
+        if(!own_fd && isatty(fd) && tcgetattr(fd, &console_saved_mode) == 0){
+            struct termios raw = console_saved_mode;    //Bytes as they are typed, the guest echoes; ISIG stays so Ctrl-C works
+            raw.c_lflag &= ~(ICANON | ECHO);
+            raw.c_cc[VMIN] = 1;
+            raw.c_cc[VTIME] = 0;
+            if(tcsetattr(fd, TCSANOW, &raw) == 0){
+                console_raw = true;
+                std::atexit(Console_Restore_Mode);
+                std::signal(SIGINT, Console_Signal);
+                std::signal(SIGTERM, Console_Signal);
+                std::signal(SIGQUIT, Console_Signal);
+            }
+        }
+        thread = std::thread(&Console_Input::Run, this);
+        return true;
+#endif
+    }
+
+    void Stop(){
+        if(!thread.joinable()) return;
+        stopping = true;
+#ifndef _WIN32
+        char wake = 0;
+        ssize_t written = write(stop_pipe[1], &wake, 1);
+        (void)written;
+#endif
+        thread.join();
+#ifndef _WIN32
+        if(!own_fd) Console_Restore_Mode();
+        else close(fd);
+        close(stop_pipe[0]);
+        close(stop_pipe[1]);
+        fd = -1;
+#endif
+    }
+
+private:
+    uint32_t Space() const { return CONSOLE_FIFO_SIZE - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire)); }
+
+    void Push(const char* bytes, uint32_t size){    //Caller made sure there is room
+        uint32_t at = head.load(std::memory_order_relaxed);
+        for(uint32_t i = 0; i < size; i++) data[(at + i) & (CONSOLE_FIFO_SIZE - 1)] = bytes[i];
+        head.store(at + size, std::memory_order_release);
+        if(received) received();
+    }
+
+#ifdef _WIN32
+    void Run_Conio(){
+        while(!stopping){
+            if(Space() == 0 || !_kbhit()){
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            char c = (char)_getch();
+            Push(&c, 1);
+        }
+    }
+#else
+    void Run(){ //Ends at end of file, on a read error or at Stop
+        while(!stopping){
+            uint32_t space = Space();
+            pollfd fds[2] = {{fd, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+            //A full FIFO waits for the guest, checking every millisecond, and leaves the rest to the host's buffers
+            int ready = space == 0 ? poll(&fds[1], 1, 1) : poll(fds, 2, -1);
+            if(ready < 0 && errno != EINTR) return;
+            if(fds[1].revents) return;
+            if(space == 0 || ready <= 0) continue;
+
+            char buffer[256];
+            ssize_t count = read(fd, buffer, std::min<uint32_t>(space, sizeof(buffer)));
+            if(count < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+            if(count <= 0) return;
+            Push(buffer, (uint32_t)count);
+        }
+    }
+#endif
+};
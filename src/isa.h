@@ -0,0 +1,95 @@
+#pragma once
+//Decoded instruction format shared by the interpreter cores and the JIT (RV32IMAC)
+#include<cstdint>
+
+struct Decoded_Instruction{//Struct to Hold the decoded Instructions
+    uint8_t opcode;
+    uint8_t rd;
+    uint8_t func3;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t func7;
+    uint8_t valid;  //Decoded_Flags
+    uint8_t op;     //Concrete instruction (Inst_Op), resolved once at decode time
+    int32_t imm;
+    uint32_t raw;   //Original word (or 16-bit parcel of a compressed instruction), kept for the flight recorder
+};
+
+//Bytes taken by the instruction whose first parcel is raw: RVC parcels don't end in 0b11
+inline uint32_t INST_LENGTH(uint32_t raw){ return (raw & 3) == 3 ? 4 : 2; }
+
+enum Decoded_Flags : uint8_t{
+    DECODED_VALID = 1,
+    DECODED_BLOCK = 2  //Instruction is part of a translated block (JIT or IR); stores to it must drop the block
+};
+
+enum Inst_Op : uint8_t{    //One entry per concrete instruction, used by the threaded core
+    OP_GENERIC,     //Anything else (SYSTEM, FENCE, odd encodings) goes through EXECUTE
+    OP_LB, OP_LH, OP_LW, OP_LBU, OP_LHU,
+    OP_ADDI, OP_SLLI, OP_SLTI, OP_SLTIU, OP_XORI, OP_SRLI, OP_SRAI, OP_ORI, OP_ANDI,
+    OP_AUIPC,
+    OP_SB, OP_SH, OP_SW,
+    OP_ADD, OP_SUB, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_SRA, OP_OR, OP_AND,
+    OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU, OP_DIV, OP_DIVU, OP_REM, OP_REMU,
+    OP_LUI,
+    OP_BEQ, OP_BNE, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU,
+    OP_JALR, OP_JAL,
+    OP_COUNT
+};
+
+inline uint8_t RESOLVE_OP(const Decoded_Instruction& inst){   //Maps opcode/func3/func7 to a concrete instruction
+    static const uint8_t loads[8] = {OP_LB, OP_LH, OP_LW, OP_GENERIC, OP_LBU, OP_LHU, OP_GENERIC, OP_GENERIC};
+    static const uint8_t stores[8] = {OP_SB, OP_SH, OP_SW, OP_GENERIC, OP_GENERIC, OP_GENERIC, OP_GENERIC, OP_GENERIC};
+    static const uint8_t alu_imm[8] = {OP_ADDI, OP_SLLI, OP_SLTI, OP_SLTIU, OP_XORI, OP_SRLI, OP_ORI, OP_ANDI};
+    static const uint8_t alu[8] = {OP_ADD, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_OR, OP_AND};
+    static const uint8_t muldiv[8] = {OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU, OP_DIV, OP_DIVU, OP_REM, OP_REMU};
+    static const uint8_t branches[8] = {OP_BEQ, OP_BNE, OP_GENERIC, OP_GENERIC, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU};
+
+    switch(inst.opcode){
+        case 0x03: return loads[inst.func3];
+        case 0x13:
+            if(inst.func3 == 0x1) return inst.func7 == 0x00 ? OP_SLLI : OP_GENERIC;
+            if(inst.func3 == 0x5){
+                if(inst.func7 == 0x00) return OP_SRLI;
+                if(inst.func7 == 0x20) return OP_SRAI;
+                return OP_GENERIC;
+            }
+            return alu_imm[inst.func3];
+        case 0x17: return OP_AUIPC;
+        case 0x23: return stores[inst.func3];
+        case 0x33:
+            if(inst.func7 == 0x00) return alu[inst.func3];
+            if(inst.func7 == 0x01) return muldiv[inst.func3];
+            if(inst.func7 == 0x20 && inst.func3 == 0x0) return OP_SUB;
+            if(inst.func7 == 0x20 && inst.func3 == 0x5) return OP_SRA;
+            return OP_GENERIC;
+        case 0x37: return OP_LUI;
+        case 0x63: return branches[inst.func3];
+        case 0x67: return inst.func3 == 0x0 ? OP_JALR : OP_GENERIC;
+        case 0x6F: return OP_JAL;
+    }
+    return OP_GENERIC;
+}
+
+//RV32M: the high multiplies and divisions, with the spec's results for division by zero
+//(quotient all ones, remainder the dividend) and for INT_MIN / -1 (quotient INT_MIN, remainder 0)
+inline uint32_t MULH(uint32_t a, uint32_t b){ return (uint32_t)(((int64_t)(int32_t)a * (int32_t)b) >> 32); }
+inline uint32_t MULHSU(uint32_t a, uint32_t b){ return (uint32_t)(((int64_t)(int32_t)a * (int64_t)b) >> 32); }
+inline uint32_t MULHU(uint32_t a, uint32_t b){ return (uint32_t)(((uint64_t)a * b) >> 32); }
+
+inline uint32_t DIV(uint32_t a, uint32_t b){
+    if(b == 0) return 0xFFFFFFFF;
+    if(a == 0x80000000 && b == 0xFFFFFFFF) return a;
+    return (uint32_t)((int32_t)a / (int32_t)b);
+}
+inline uint32_t DIVU(uint32_t a, uint32_t b){ return b ? a / b : 0xFFFFFFFF; }
+inline uint32_t REM(uint32_t a, uint32_t b){
+    if(b == 0) return a;
+    if(a == 0x80000000 && b == 0xFFFFFFFF) return 0;
+    return (uint32_t)((int32_t)a % (int32_t)b);
+}
+inline uint32_t REMU(uint32_t a, uint32_t b){ return b ? a % b : a; }
+
+inline bool ENDS_BLOCK(uint8_t op){ //Control flow and SYSTEM instructions close a basic block
+    return op == OP_GENERIC || (op >= OP_BEQ && op <= OP_JAL);
+}
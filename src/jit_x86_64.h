@@ -0,0 +1,311 @@
+#pragma once
+//x86-64 code generator for the JIT tier.
+//Turns a straight-line run of decoded RV32IMC instructions into a native function
+//  uint32_t block(RISC_V* cpu)
+//that works directly on cpu->regs and returns how many guest instructions it retired.
+//Loads, stores, conditional branches and (with a predictor) jumps call back into the emulator
+//through helpers, so permission checks, MMIO and the branch predictor behave exactly as in the
+//interpreter.
+#include<cstdint>
+#include<cstring>
+#include<vector>
+
+#include "isa.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED 1
+#include<sys/mman.h>
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+static const size_t JIT_CACHE_SIZE = 32 * 1024 * 1024;  //Executable code cache (bytes)
+
+typedef uint32_t (*Jit_Entry)(void* cpu);
+
+struct Jit_Block{   //A translated guest basic block
+    uint32_t start_pc;
+    uint32_t end_pc;    //First byte past the block
+    uint32_t count; //Guest instructions in the block
+    Jit_Entry code; //Native entry point inside the code cache
+    std::vector<uint32_t> raw;  //Guest words and RVC parcels, replayed into the flight recorder
+    bool ends_in_jump;  //Last instruction is a JAL/JALR
+};
+
+struct Jit_Layout{  //Where the generated code finds emulator state and helpers
+    int32_t regs;   //Offset of regs[0] from the cpu pointer
+    int32_t pc;     //Offset of PC
+    int32_t exit;   //Offset of the bool set by helpers when the block must stop
+    const void* load[5];    //LB LH LW LBU LHU: uint32_t (cpu, addr, index)
+    const void* store[3];   //SB SH SW: void (cpu, addr, value, index)
+    const void* branch;     //void (cpu, taken, target, index, next_pc, pc)
+    const void* jump;       //void (cpu, target, index, pc, rd | rs1 << 8, link), nullptr without a predictor or profiler
+};
+
+struct Jit_Code_Cache{  //Bump allocator over one RWX mapping, flushed as a whole
+    uint8_t* base = nullptr;
+    size_t used = 0;
+
+    bool Init(){
+#if JIT_SUPPORTED
+        void* mem = mmap(nullptr, JIT_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mem == MAP_FAILED) return false;
+        base = static_cast<uint8_t*>(mem);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    ~Jit_Code_Cache(){
+#if JIT_SUPPORTED
+        if(base) munmap(base, JIT_CACHE_SIZE);
+#endif
+    }
+
+    uint8_t* Install(const std::vector<uint8_t>& code){ //Copies code in, nullptr when full
+        if(used + code.size() > JIT_CACHE_SIZE) return nullptr;
+        uint8_t* dst = base + used;
+        std::memcpy(dst, code.data(), code.size());
+        used = (used + code.size() + 15) & ~(size_t)15;
+        return dst;
+    }
+
+    void Reset(){ used = 0; }
+};
+
+struct X86_Emitter{ //Just the handful of encodings the translator needs
+    enum Reg{ EAX = 0, ECX = 1, EDX = 2, EBX = 3, ESI = 6, EDI = 7 };
+    enum Alu{ ADD = 0, OR = 1, AND = 4, SUB = 5, XOR = 6, CMP = 7 };    //Group-1 /digit
+    enum Shift{ SHL = 4, SHR = 5, SAR = 7 };    //Group-2 /digit
+    enum Cond{ CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD };
+
+    std::vector<uint8_t> code;
+    int32_t regs_off;
+
+    void byte(uint8_t b){ code.push_back(b); }
+    void dword(uint32_t d){ for(int i = 0; i < 4; i++) byte((d >> (8 * i)) & 0xFF); }
+    void qword(uint64_t q){ dword((uint32_t)q); dword((uint32_t)(q >> 32)); }
+
+    void mem_rbx(int reg, int32_t disp){ byte(0x80 | (reg << 3) | EBX); dword(disp); }  //[rbx + disp32]
+
+    void load_guest(Reg r, int guest){ //r32 = x[guest]
+        if(guest == 0){ byte(0x31); byte(0xC0 | (r << 3) | r); return; }   //xor r, r
+        byte(0x8B); mem_rbx(r, regs_off + 4 * guest);
+    }
+    void store_guest(int guest, Reg r){ //x[guest] = r32, writes to x0 vanish
+        if(guest == 0) return;
+        byte(0x89); mem_rbx(r, regs_off + 4 * guest);
+    }
+    void store_imm(int32_t disp, uint32_t imm){ byte(0xC7); mem_rbx(0, disp); dword(imm); }
+    void mov_imm(Reg r, uint32_t imm){ byte(0xB8 + r); dword(imm); }
+    void mov_rr(Reg dst, Reg src){ byte(0x89); byte(0xC0 | (src << 3) | dst); }
+    void alu_rr(Alu op, Reg dst, Reg src){ byte(0x01 + (op << 3)); byte(0xC0 | (src << 3) | dst); }
+    void alu_ri(Alu op, Reg dst, uint32_t imm){ byte(0x81); byte(0xC0 | (op << 3) | dst); dword(imm); }
+    void shift_ri(Shift op, Reg dst, uint8_t amount){ byte(0xC1); byte(0xC0 | (op << 3) | dst); byte(amount); }
+    void shift_cl(Shift op, Reg dst){ byte(0xD3); byte(0xC0 | (op << 3) | dst); }
+    void imul_rr(Reg dst, Reg src){ byte(0x0F); byte(0xAF); byte(0xC0 | (dst << 3) | src); }
+    void imul_rr64(Reg dst, Reg src){ byte(0x48); imul_rr(dst, src); }
+    void movsxd(Reg r){ byte(0x48); byte(0x63); byte(0xC0 | (r << 3) | r); }    //r64 = sign-extended r32
+    void append(const X86_Emitter& other){ code.insert(code.end(), other.code.begin(), other.code.end()); }
+    void setcc_zx(Cond cc, Reg dst){    //dst = flags satisfy cc ? 1 : 0
+        byte(0x0F); byte(0x90 + cc); byte(0xC0 | EAX);  //setcc al
+        byte(0x0F); byte(0xB6); byte(0xC0 | (dst << 3) | EAX);  //movzx dst, al
+    }
+    void call(const void* fn){
+        byte(0x48); byte(0x89); byte(0xDF);  //mov rdi, rbx
+        byte(0x48); byte(0xB8); qword((uint64_t)(uintptr_t)fn);  //mov rax, imm64
+        byte(0xFF); byte(0xD0);  //call rax
+    }
+    void prologue(){ byte(0x53); byte(0x48); byte(0x89); byte(0xFB); } //push rbx; mov rbx, rdi
+    void leave(uint32_t retired){ mov_imm(EAX, retired); byte(0x5B); byte(0xC3); }  //pop rbx; ret
+
+    void jump_call(const Jit_Layout& L, uint32_t index, uint32_t pc, uint32_t link_regs, uint32_t link){   //Predictor callback, target in esi
+        mov_imm(EDX, index);
+        mov_imm(ECX, pc);
+        byte(0x41); byte(0xB8); dword(link_regs);  //mov r8d, link_regs
+        byte(0x41); byte(0xB9); dword(link);   //mov r9d, link
+        call(L.jump);
+    }
+
+    void exit_if_flagged(const Jit_Layout& L, uint32_t next_pc, uint32_t retired){
+        byte(0x80); mem_rbx(7, L.exit); byte(0x00);  //cmp byte [rbx + exit], 0
+        byte(0x74); byte(17);  //je over the 17-byte exit sequence
+        store_imm(L.pc, next_pc);
+        leave(retired);
+    }
+};
+
+//Translates insts (consecutive instructions starting at start_pc) into x86-64; the last entry
+//may be a branch or jump, everything before it is straight-line code.
+inline std::vector<uint8_t> Jit_Translate(const std::vector<Decoded_Instruction>& insts, uint32_t start_pc, const Jit_Layout& L){
+    typedef X86_Emitter E;
+    E e;
+    e.regs_off = L.regs;
+    e.prologue();
+    uint32_t pc = start_pc;
+
+    for(uint32_t i = 0; i < insts.size(); pc += INST_LENGTH(insts[i].raw), i++){
+        const Decoded_Instruction& in = insts[i];
+        uint32_t next_pc = pc + INST_LENGTH(in.raw);
+        uint32_t imm = (uint32_t)in.imm;
+
+        switch(in.op){
+            case OP_ADD: case OP_SUB: case OP_XOR: case OP_OR: case OP_AND:{
+                if(in.rd == 0) break;
+                E::Alu op = in.op == OP_ADD ? E::ADD : in.op == OP_SUB ? E::SUB : in.op == OP_XOR ? E::XOR : in.op == OP_OR ? E::OR : E::AND;
+                e.load_guest(E::EAX, in.rs1);
+                e.load_guest(E::ECX, in.rs2);
+                e.alu_rr(op, E::EAX, E::ECX);
+                e.store_guest(in.rd, E::EAX);
+                break;
+            }
+            case OP_SLT: case OP_SLTU:
+                if(in.rd == 0) break;
+                e.load_guest(E::EAX, in.rs1);
+                e.load_guest(E::ECX, in.rs2);
+                e.alu_rr(E::CMP, E::EAX, E::ECX);
+                e.setcc_zx(in.op == OP_SLT ? E::CC_L : E::CC_B, E::EAX);
+                e.store_guest(in.rd, E::EAX);
+                break;
+            case OP_SLL: case OP_SRL: case OP_SRA:  //x86 masks the count to 5 bits like RV32
+                if(in.rd == 0) break;
+                e.load_guest(E::EAX, in.rs1);
+                e.load_guest(E::ECX, in.rs2);
+                e.shift_cl(in.op == OP_SLL ? E::SHL : in.op == OP_SRL ? E::SHR : E::SAR, E::EAX);
+                e.store_guest(in.rd, E::EAX);
+                break;
+            case OP_MUL:
+                if(in.rd == 0) break;
+                e.load_guest(E::EAX, in.rs1);
+                e.load_guest(E::ECX, in.rs2);
+                e.imul_rr(E::EAX, E::ECX);
+                e.store_guest(in.rd, E::EAX);
+                break;
+            case OP_MULH: case OP_MULHSU: case OP_MULHU:    //Full 64-bit product, 32-bit loads zero-extend
+                if(in.rd == 0) break;
+                e.load_guest(E::EAX, in.rs1);
+                e.load_guest(E::ECX, in.rs2);
+                if(in.op != OP_MULHU) e.movsxd(E::EAX);
+                if(in.op == OP_MULH) e.movsxd(E::ECX);
+                e.imul_rr64(E::EAX, E::ECX);
+                e.byte(0x48); e.shift_ri(E::SHR, E::EAX, 32);   //shr rax, 32
+                e.store_guest(in.rd, E::EAX);
+                break;
+            case OP_DIV: case OP_DIVU: case OP_REM: case OP_REMU:{
+                //Division by zero skips the divide: eax already holds the remainder (the dividend),
+                //quotients become all ones. Signed division is done in 64 bits, where INT_MIN / -1
+                //doesn't trap and its low half is the result the spec wants.
+                if(in.rd == 0) break;
+                bool is_signed = in.op == OP_DIV || in.op == OP_REM;
+                bool quotient = in.op == OP_DIV || in.op == OP_DIVU;
+                E divide;
+                if(is_signed){
+                    divide.movsxd(E::EAX);
+                    divide.movsxd(E::ECX);
+                    divide.byte(0x48); divide.byte(0x99);   //cqo
+                    divide.byte(0x48); divide.byte(0xF7); divide.byte(0xF9);    //idiv rcx
+                }
+                else{
+                    divide.alu_rr(E::XOR, E::EDX, E::EDX);
+                    divide.byte(0xF7); divide.byte(0xF1);   //div ecx
+                }
+                if(!quotient) divide.mov_rr(E::EAX, E::EDX);
+                E by_zero;
+                if(quotient) by_zero.mov_imm(E::EAX, 0xFFFFFFFF);
+                if(by_zero.code.size()){ divide.byte(0xEB); divide.byte((uint8_t)by_zero.code.size()); }   //jmp over it
+
+                e.load_guest(E::EAX, in.rs1);
+                e.load_guest(E::ECX, in.rs2);
+                e.byte(0x85); e.byte(0xC9);     //test ecx, ecx
+                e.byte(0x74); e.byte((uint8_t)divide.code.size());  //jz by_zero
+                e.append(divide);
+                e.append(by_zero);
+                e.store_guest(in.rd, E::EAX);
+                break;
+            }
+            case OP_ADDI: case OP_XORI: case OP_ORI: case OP_ANDI:
+                if(in.rd == 0) break;
+                e.load_guest(E::EAX, in.rs1);
+                e.alu_ri(in.op == OP_ADDI ? E::ADD : in.op == OP_XORI ? E::XOR : in.op == OP_ORI ? E::OR : E::AND, E::EAX, imm);
+                e.store_guest(in.rd, E::EAX);
+                break;
+            case OP_SLTI: case OP_SLTIU:
+                if(in.rd == 0) break;
+                e.load_guest(E::EAX, in.rs1);
+                e.alu_ri(E::CMP, E::EAX, imm);
+                e.setcc_zx(in.op == OP_SLTI ? E::CC_L : E::CC_B, E::EAX);
+                e.store_guest(in.rd, E::EAX);
+                break;
+            case OP_SLLI: case OP_SRLI: case OP_SRAI:
+                if(in.rd == 0) break;
+                e.load_guest(E::EAX, in.rs1);
+                e.shift_ri(in.op == OP_SLLI ? E::SHL : in.op == OP_SRLI ? E::SHR : E::SAR, E::EAX, imm & 0x1F);
+                e.store_guest(in.rd, E::EAX);
+                break;
+            case OP_LUI:
+                if(in.rd) e.store_imm(L.regs + 4 * in.rd, imm);
+                break;
+            case OP_AUIPC:
+                if(in.rd) e.store_imm(L.regs + 4 * in.rd, pc + imm);
+                break;
+
+            case OP_LB: case OP_LH: case OP_LW: case OP_LBU: case OP_LHU:
+                e.load_guest(E::ESI, in.rs1);
+                if(imm) e.alu_ri(E::ADD, E::ESI, imm);
+                e.mov_imm(E::EDX, i);
+                e.call(L.load[in.op - OP_LB]);
+                e.store_guest(in.rd, E::EAX);
+                e.exit_if_flagged(L, next_pc, i + 1);
+                break;
+            case OP_SB: case OP_SH: case OP_SW:
+                e.load_guest(E::ESI, in.rs1);
+                if(imm) e.alu_ri(E::ADD, E::ESI, imm);
+                e.load_guest(E::EDX, in.rs2);
+                e.mov_imm(E::ECX, i);
+                e.call(L.store[in.op - OP_SB]);
+                e.exit_if_flagged(L, next_pc, i + 1);
+                break;
+
+            case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BGE: case OP_BLTU: case OP_BGEU:{
+                static const E::Cond conds[] = {E::CC_E, E::CC_NE, E::CC_L, E::CC_GE, E::CC_B, E::CC_AE};
+                e.load_guest(E::EAX, in.rs1);
+                e.load_guest(E::ECX, in.rs2);
+                e.alu_rr(E::CMP, E::EAX, E::ECX);
+                e.setcc_zx(conds[in.op - OP_BEQ], E::ESI);
+                e.mov_imm(E::EDX, pc + imm);
+                e.mov_imm(E::ECX, i);
+                e.byte(0x41); e.byte(0xB8); e.dword(next_pc);  //mov r8d, next_pc
+                e.byte(0x41); e.byte(0xB9); e.dword(pc);   //mov r9d, pc
+                e.call(L.branch);
+                e.leave(i + 1);
+                return e.code;
+            }
+            case OP_JAL:
+                if(in.rd) e.store_imm(L.regs + 4 * in.rd, next_pc);
+                e.store_imm(L.pc, pc + imm);
+                if(L.jump){
+                    e.mov_imm(E::ESI, pc + imm);
+                    e.jump_call(L, i, pc, in.rd, next_pc);
+                }
+                e.leave(i + 1);
+                return e.code;
+            case OP_JALR:   //Target is computed before rd is written, rd may equal rs1
+                e.load_guest(E::EAX, in.rs1);
+                if(imm) e.alu_ri(E::ADD, E::EAX, imm);
+                e.alu_ri(E::AND, E::EAX, ~1u);
+                if(in.rd) e.store_imm(L.regs + 4 * in.rd, next_pc);
+                e.byte(0x89); e.mem_rbx(E::EAX, L.pc);    //mov [rbx + pc], eax
+                if(L.jump){
+                    e.mov_rr(E::ESI, E::EAX);
+                    e.jump_call(L, i, pc, in.rd | (in.rs1 << 8), next_pc);
+                }
+                e.leave(i + 1);
+                return e.code;
+        }
+    }
+
+    e.store_imm(L.pc, pc);  //Fell off the end of a straight-line block
+    e.leave((uint32_t)insts.size());
+    return e.code;
+}
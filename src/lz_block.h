@@ -0,0 +1,103 @@
+#pragma once
+//Byte-oriented LZ77 block compression in the style of LZ4, fast enough to keep up with a trace
+//writer. A compressed block is a run of sequences:
+//  token       high nibble: literal count, low nibble: match length - LZ_MIN_MATCH (15 = more follows)
+//  [length]    extra literal count bytes, 255 means another byte follows
+//  literals
+//  offset      u16 little-endian distance back to the match (1 .. 65535)
+//  [length]    extra match length bytes
+//The last sequence stops after its literals. Matches may overlap the bytes they produce.
+#include<cstdint>
+#include<cstddef>
+#include<cstring>
+#include<vector>
+
+static const uint32_t LZ_MIN_MATCH = 4;
+static const uint32_t LZ_HASH_BITS = 14;
+static const uint32_t LZ_MAX_OFFSET = 0xFFFF;
+
+inline void Lz_Put_Length(std::vector<uint8_t>& out, size_t length){
+    while(length >= 255){
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back((uint8_t)length);
+}
+
+inline void Lz_Put_Sequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t literal_count,
+                            size_t offset, size_t match_length){
+    size_t extra = match_length ? match_length - LZ_MIN_MATCH : 0;
+    out.push_back((uint8_t)(((literal_count < 15 ? literal_count : 15) << 4) | (extra < 15 ? extra : 15)));
+    if(literal_count >= 15) Lz_Put_Length(out, literal_count - 15);
+    out.insert(out.end(), literals, literals + literal_count);
+    if(!match_length) return;   //Last sequence
+
+    out.push_back((uint8_t)offset);
+    out.push_back((uint8_t)(offset >> 8));
+    if(extra >= 15) Lz_Put_Length(out, extra - 15);
+}
+
+inline void Lz_Compress(const uint8_t* in, size_t size, std::vector<uint8_t>& out){
+    out.clear();
+    std::vector<uint32_t> table(1u << LZ_HASH_BITS, 0);    //Last position + 1 of each 4-byte hash, 0 = none
+
+    size_t anchor = 0, i = 0;
+    while(i + LZ_MIN_MATCH <= size){
+        uint32_t seq;
+        std::memcpy(&seq, in + i, 4);
+        uint32_t hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t candidate = table[hash];
+        table[hash] = (uint32_t)(i + 1);
+
+        if(candidate == 0 || i - (candidate - 1) > LZ_MAX_OFFSET || std::memcmp(in + candidate - 1, in + i, 4) != 0){
+            i++;
+            continue;
+        }
+        candidate--;
+
+        size_t length = LZ_MIN_MATCH;
+        while(i + length < size && in[candidate + length] == in[i + length]) length++;
+
+        Lz_Put_Sequence(out, in + anchor, i - anchor, i - candidate, length);
+        i += length;
+        anchor = i;
+    }
+    Lz_Put_Sequence(out, in + anchor, size - anchor, 0, 0);
+}
+
+inline bool Lz_Get_Length(const uint8_t* in, size_t size, size_t& pos, size_t& length){
+    uint8_t byte;
+    do{
+        if(pos >= size) return false;
+        byte = in[pos++];
+        length += byte;
+    } while(byte == 255);
+    return true;
+}
+
+//Decodes a block that expands to exactly size bytes; false if it is malformed
+inline bool Lz_Decompress(const uint8_t* in, size_t length, uint8_t* out, size_t size){
+    size_t pos = 0, at = 0;
+    while(pos < length){
+        uint8_t token = in[pos++];
+
+        size_t literal_count = token >> 4;
+        if(literal_count == 15 && !Lz_Get_Length(in, length, pos, literal_count)) return false;
+        if(literal_count > length - pos || literal_count > size - at) return false;
+        std::memcpy(out + at, in + pos, literal_count);
+        pos += literal_count;
+        at += literal_count;
+        if(pos == length) break;    //Last sequence
+
+        if(length - pos < 2) return false;
+        size_t offset = in[pos] | (in[pos + 1] << 8);
+        pos += 2;
+        size_t match_length = token & 15;
+        if(match_length == 15 && !Lz_Get_Length(in, length, pos, match_length)) return false;
+        match_length += LZ_MIN_MATCH;
+        if(offset == 0 || offset > at || match_length > size - at) return false;
+
+        for(size_t k = 0; k < match_length; k++, at++) out[at] = out[at - offset];
+    }
+    return at == size;
+}
@@ -4,88 +4,243 @@
 #include<string>
 #include<cstring>
 #include<vector>
-#include<conio.h>
+#include<unordered_map>
+#include<chrono>
+#include<atomic>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<memory>
+#include<algorithm>
+#include<sstream>
+
+#include "host_console.h"
+#include "console_output.h"
+#include "isa.h"
+#include "rvc.h"
+#include "block_cache.h"
+#include "bus.h"
+#include "ram.h"
+#include "mapped_file.h"
+#include "snapshot.h"
+#include "branch_predictor.h"
+#include "cache_model.h"
+#include "thread_pool.h"
+#include "batch.h"
+#include "trace.h"
+#include "profiler.h"
+#include "block_ir.h"
+#include "jit_x86_64.h"
 
-//Global Variables
-uint64_t cycle_count = 0;   //cycles executed
-uint64_t inst_count = 0;    //instructions executed;
+static const int TRACE_SIZE = 100;
+
+static const uint32_t HART_STACK_SIZE = 0x10000;   //Read/write stack each hart gets below the top of dram
 
-struct TraceRecord{ //Struct to hold trace buffer records
-    uint32_t pc;
-    uint32_t raw;
+struct Memory_Segment{  //Struct to hold info about a Given memory segment
+    uint32_t start; // Starting address
+    uint32_t end;   // End Address
+    uint32_t flags; //Flags i.e 1,2,4 etc
 };
 
-static const int TRACE_SIZE = 100;
-TraceRecord trace_buffer[TRACE_SIZE];
-int trace_index = 0;
-bool trace_full = false;
+enum Core_Kind{ //Execution cores selectable at startup
+    CORE_SWITCH,    //Reference interpreter: nested switch in EXECUTE
+    CORE_THREADED,  //Handler per concrete instruction, chained with computed goto
+    CORE_JIT,       //Switch interpreter for cold code, hot blocks translated to x86-64
+    CORE_BLOCK      //Switch interpreter for cold code, hot blocks lifted to optimized micro-op IR
+};
 
-void Log_Trace(uint32_t pc, uint32_t raw){  //Logs traces using circular logic
-    trace_buffer[trace_index].pc = pc;
-    trace_buffer[trace_index].raw = raw;
+enum Hpm_Event{ //mhpmevent values
+    HPM_NONE,
+    HPM_LOADS,
+    HPM_STORES,
+    HPM_BRANCHES,   //Conditional branches
+    HPM_TAKEN_BRANCHES,
+    HPM_JUMPS,  //JAL and JALR
+    HPM_MMIO,   //Loads and stores that reached a device
+    HPM_TRAPS,
+    HPM_COUNTED,    //Events up to here are counted in hpm_events, the rest come from the models
+    HPM_MISPREDICTS = HPM_COUNTED,  //Branches and jumps that paid the flush penalty
+    HPM_L1I_MISSES,
+    HPM_L1D_MISSES,
+    HPM_L2_MISSES
+};
+
+enum Page_Attr : uint8_t{   //Per-page entry of the permission table, low bits match the ELF p_flags
+    PAGE_X = 1,
+    PAGE_W = 2,
+    PAGE_R = 4,
+    PAGE_MIXED = 8, //Permissions change inside the page: see its Mixed_Page
+    PAGE_MMIO = 16  //Page holds device registers (CLINT, UART)
+};
 
-    trace_index = (trace_index + 1) % TRACE_SIZE;
-    if(trace_index == 0) trace_full = true;
+template<typename T> inline T Guest_Order(T val){   //Guest memory is little-endian; swaps on big-endian hosts
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    if(sizeof(T) == 2) return (T)__builtin_bswap16(val);
+    if(sizeof(T) == 4) return (T)__builtin_bswap32(val);
+#endif
+    return val;
 }
 
-void Dump_Trace(){  //Dumps trace duh!
-    std::cout<<"\n|| Trace Dump ||\n";
-    std::cout<<"---------------------------------\n";
+struct Mixed_Page{  //Per-byte Page_Attr permissions of a page that is only partly covered by a segment
+    uint8_t attr[PAGE_SIZE];
+};
 
-    int start = trace_full ? trace_index : 0;
-    int count = trace_full ? TRACE_SIZE : trace_index;
+struct Decoded_Page{    //Decoded instructions of one guest page, one slot per halfword (RVC code is 2-byte aligned)
+    Decoded_Instruction inst[PAGE_SIZE / 2];
 
-    for(int i=0; i<count ; i++){
-        int idx = (start + i) % TRACE_SIZE;
-        std::cout<<"PC: 0x"<<std::hex<<trace_buffer[idx].pc<<" | Inst: 0x"<<trace_buffer[idx].raw<<std::dec<<std::endl;
+    Decoded_Page(){
+        for(auto& e : inst) e.valid = 0;
     }
-    std::cout<<"---------------------------------\n";
-}
+};
 
-struct BranchPredictor{ //Predictes Branch in advance to save time
-    uint8_t table[4096];
-    uint64_t total; //Helper var: Total prediction;
-    uint64_t correct;   //Helper var: Correct predictions;
+//Wakes harts idling in WFI. Whoever zeroes another hart's next_event (msip, mtimecmp, the UART
+//RX line) or stops the machine calls Notify after the store; the sleeper checks next_event with
+//the mutex held, so the wake-up cannot slip in between the check and the wait.
+struct Idle_Signal{
+    std::mutex mutex;
+    std::condition_variable wake;
 
-    BranchPredictor(){
-        std::memset(table, 1, 4096);    //initialzing the table with 1s
+    void Notify(){
+        std::lock_guard<std::mutex> lock(mutex);
+        wake.notify_all();
     }
+};
 
-    bool predict(uint32_t pc){
-        return table[(pc >> 2) & 0xFFF] >= 2;
-    }
+struct Clint_Hart{  //Registers of one hart, owned by its RISC_V
+    std::atomic<uint64_t>* mtimecmp;
+    std::atomic<bool>* mtip_clear;  //Set by an mtimecmp write; the owner clears mip.MTIP in Service_Events
+    std::atomic<uint32_t>* msip;
+    std::atomic<uint64_t>* next_event; //Zeroed after a write so the hart re-checks its interrupts
+    const uint64_t* cycle_count;    //mtime = cycle_count + time_offset
+    uint64_t* time_offset;
+};
 
-    void update(uint32_t pc, bool taken){   //Updates the table based on actual and predicted operation
-        uint32_t index = (pc >> 2) & 0xFFF;
-        uint8_t state = table[index];
+//Core-local interruptor: msip and mtimecmp for every hart, mtime (the reading hart's cycle counter).
+//Harts keep their own clocks, so mtime is per hart: an mtimecmp written for another hart is
+//compared against that hart's time, not the writer's. Harts never touch each other's CSRs.
+struct Clint_Device : Device{
+    std::vector<Clint_Hart> harts;  //Indexed by mhartid
+    Idle_Signal* idle = nullptr;
 
-        total++;
+    bool Read(uint32_t hart, uint32_t addr, uint32_t size, uint32_t& val) override{
+        if(size != 4) return false;
 
-        if(taken){
-            if(state < 3) table[index]++; 
+        if(addr - 0x02000000 < 4 * harts.size() && (addr & 3) == 0){   //msip
+            val = harts[(addr - 0x02000000) >> 2].msip->load();
+            return true;
         }
-        else{
-            if(state > 0) table[index]--;
+
+        uint64_t current_time = *harts[hart].cycle_count + *harts[hart].time_offset;
+
+        if (addr == 0x0200BFF8){    //lower 32 bits
+            val = (uint32_t)(current_time & 0xFFFFFFFF);
+            return true;
         }
+
+        if (addr == 0x0200BFFC){    //higher 32 bits
+            val = (uint32_t)(current_time >> 32);
+            return true;
+        }
+        return false;
     }
 
-};
-BranchPredictor btb;
+    bool Write(uint32_t hart, uint32_t addr, uint32_t size, uint32_t val) override{
+        if(size != 4 || (addr & 3)) return false;
+
+        if(addr == 0x0200BFF8 || addr == 0x0200BFFC){  //mtime: the writing hart's clock jumps, its cycle counter doesn't
+            Clint_Hart& self = harts[hart];
+            uint64_t current_time = *self.cycle_count + *self.time_offset;
+            if(addr == 0x0200BFF8) current_time = (current_time & 0xFFFFFFFF00000000) | (uint64_t)val;
+            else current_time = (current_time & 0x00000000FFFFFFFF) | ((uint64_t)val << 32);
+            *self.time_offset = current_time - *self.cycle_count;
+            self.next_event->store(0);
+            return true;    //Only the writing hart's clock moved, and it is not idle
+        }
 
-struct Memory_Segment{  //Struct to hold info about a Given memory segment
-    uint32_t start; // Starting address
-    uint32_t end;   // End Address
-    uint32_t flags; //Flags i.e 1,2,4 etc
+        if(addr - 0x02000000 < 4 * harts.size()){  //msip: only bit 0 is writable
+            Clint_Hart& target = harts[(addr - 0x02000000) >> 2];
+            target.msip->store(val & 1);
+            target.next_event->store(0);
+            idle->Notify();
+            return true;
+        }
+
+        uint32_t target = (addr - 0x02004000) >> 3;
+        if(addr < 0x02004000 || target >= harts.size()) return false;
+        std::atomic<uint64_t>& mtimecmp = *harts[target].mtimecmp;
+        uint64_t old = mtimecmp.load();
+        uint64_t updated;
+
+        do{
+            if((addr & 4) == 0) updated = (old & 0xFFFFFFFF00000000) | (uint64_t)val;   //lower 32 bits
+            else updated = (old & 0x00000000FFFFFFFF) | ((uint64_t)val << 32);   //higher 32 bits
+        } while(!mtimecmp.compare_exchange_weak(old, updated));
+        if(addr & 4) harts[target].mtip_clear->store(true);   //clear pending bit, done by the owning hart
+        harts[target].next_event->store(0);
+        idle->Notify();
+        return true;
+    }
 };
 
-struct Decoded_Instruction{//Struct to Hold the decoded Instructions
-    uint8_t opcode;
-    uint8_t rd;
-    uint8_t func3;
-    uint8_t rs1;
-    uint8_t rs2;
-    uint8_t func7;
-    int32_t imm;
+//Console UART, registers as on a 16550: 0x10000000 sends (write) or takes (read) a byte,
+//0x10000001 is the interrupt enable, bit 0 raising an RX interrupt while input is waiting, and
+//0x10000005 reads 1 while input is waiting. There is no PLIC; the RX line is hart 0's MEIP.
+struct Uart_Device : Device{
+    Console_Output output{std::cout};   //Batch jobs capture their output instead
+    Console_Input input;    //Empty unless the run reads stdin or --uart-in
+    std::atomic<uint32_t> ier{0};   //Interrupt enable register
+    std::atomic<uint64_t>* rx_event = nullptr;  //next_event of hart 0, zeroed when the RX line may have risen
+    Idle_Signal* idle = nullptr;
+
+    Uart_Device(){
+        input.received = [this]{ Raise(); };
+    }
+
+    bool Rx_Interrupt() const { return (ier.load(std::memory_order_relaxed) & 1) && input.Available(); }
+
+    void Raise(){   //Set then zero next_event, like msip: the hart either sees the byte or re-checks after it
+        if((ier.load(std::memory_order_relaxed) & 1) && rx_event){
+            rx_event->store(0);
+            idle->Notify();
+        }
+    }
+
+    bool Read(uint32_t hart, uint32_t addr, uint32_t size, uint32_t& val) override{
+        (void)hart;
+        if(size != 1) return false;
+
+        if(addr == 0x10000005) { //Checks if a key is pressed or not
+            val = input.Available() ? 0x01 : 0x00;
+            return true;
+        }
+
+        if(addr == 0x10000000) {    //If key is pressed reads the character and returns it
+            uint8_t byte = 0;
+            input.Take(byte);
+            val = byte;
+            return true;
+        }
+
+        if(addr == 0x10000001){
+            val = ier.load(std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    bool Write(uint32_t hart, uint32_t addr, uint32_t size, uint32_t val) override{
+        if(size != 1) return false;
+
+        if(addr == 0x10000001){
+            ier.store(val & 1);
+            Raise();
+            return true;
+        }
+        if(addr != 0x10000000) return false;
+
+        output.Put(hart, (char)val);    //Print to terminal, once the line is done
+        return true;
+    }
 };
 
 //ELF32 Header
@@ -117,55 +272,78 @@ struct Elf32_Phdr {// Program Header
     uint32_t p_align;
 };
 
-struct RISC_V
-{
-    uint32_t regs[32];
-    uint32_t PC;
-    uint32_t MAX_MEMORY;
-    uint8_t* memory;
-    uint32_t MEM_Offset;
-    std::vector<Memory_Segment> memory_map;
-    bool running;
-
-    uint32_t csrs[4096]; // CSR registers
-
-    const uint32_t MCYCLE_L   = 0xB00; // machine cycle counter (low)
-    const uint32_t MCYCLE_H   = 0xB80; // machine cycle counter (high)
-    const uint32_t MINSTRET_L  = 0xB02; // instructions retired (low)
-    const uint32_t MINSTRET_H = 0xB82; // instructions retired (high)
-
-    const uint32_t UART_addr = 0x10000000; //Address of the special i/o location
-
-    uint64_t mtimecmp = 0xffffffffffffffff; //Alarm time
-    uint32_t mtvec = 0; //Address of the interrupt handler
-    uint32_t mepc = 0;  //Old PC (return after interrupt)
-    uint32_t mcause = 0;    //Cause of interrupt
-    uint32_t mstatus = 0;   //machine status
-
-    RISC_V()
-    {
-        
-        MAX_MEMORY = 1024 * 1024 * 64;  //Memory size is set to 64MB
-        //Setting all registers to 0
-        for(int i=0 ; i<32 ; i++) {
-            regs[i] = 0;
-        }
-       
-        memory = new uint8_t[MAX_MEMORY]{0}; //Allocating Memory
-        PC = 0; //The Program counter starts at the begging of memory
+struct Elf32_Shdr {// Section Header
+    uint32_t sh_name;
+    uint32_t sh_type;   // 2 = SYMTAB
+    uint32_t sh_flags;  // 4 = executable
+    uint32_t sh_addr;
+    uint32_t sh_offset; // File offset
+    uint32_t sh_size;
+    uint32_t sh_link;   // SYMTAB: section of its string table
+    uint32_t sh_info;
+    uint32_t sh_addralign;
+    uint32_t sh_entsize;
+};
 
-        running = false;
+struct Elf32_Sym {// Symbol table entry
+    uint32_t st_name;   // Offset in the string table
+    uint32_t st_value;
+    uint32_t st_size;
+    unsigned char st_info;  // Binding << 4 | type
+    unsigned char st_other;
+    uint16_t st_shndx;  // Section it belongs to
+};
 
-        for(int i=0; i<4096; i++) csrs[i] = 0;
+//Everything the harts share: guest RAM, its permission tables and the devices
+struct Machine{
+    Ram_Region dram;    //Main memory: program, stacks, decode and block caches
+    bool dram_auto_base = true; //Place dram at the lowest ELF segment unless --ram gave a base
+    std::vector<Ram_Region> extra_ram;  //Further --ram regions: plain read/write memory
+    std::vector<Memory_Segment> memory_map;
+    std::vector<uint8_t> page_attr; //Page_Attr for every 4 KiB page of the 32 bit address space
+    std::vector<Mixed_Page*> mixed_pages;   //Byte permissions of PAGE_MIXED pages, indexed by DRAM page
+    uint32_t stack_window = HART_STACK_SIZE;    //Read/write stacks at the top of dram, one per hart
+    uint32_t entry = 0; //ELF entry point, every hart starts there
+    Symbol_Table symbols;   //Code symbols from the ELF, for --profile
+
+    Mmio_Bus bus;   //Devices; attach before LOAD_FILE so their pages get marked PAGE_MMIO
+    Clint_Device* clint;    //Owned by bus, harts register with it
+    Uart_Device* uart;  //Owned by bus
+    Idle_Signal idle;   //Harts in WFI sleep on it
+    std::ostream* errors = &std::cerr;  //Load errors and faults
+    std::vector<std::atomic<bool>*> running;    //Run flag of every hart
+
+    //How the run ended, written by the harts
+    std::atomic<bool> exited{false};    //exit ecall, code in exit_code
+    std::atomic<bool> faulted{false};   //Segmentation fault
+    std::atomic<bool> limited{false};   //--limit reached
+    uint32_t exit_code = 0;
+
+    Machine(){
+        dram.size = 1024 * 1024 * 64;  //Memory size defaults to 64MB, allocated by LOAD_FILE
+
+        clint = new Clint_Device();
+        clint->idle = &idle;
+        bus.Attach(0x02000000, 0x10000, clint);
+        uart = new Uart_Device();
+        uart->idle = &idle;
+        bus.Attach(0x10000000, 8, uart);
+    }
 
+    ~Machine(){
+        dram.Release();
+        for(auto& region : extra_ram) region.Release();
+        for(auto page : mixed_pages) delete page;
     }
 
-    ~RISC_V(){
-        delete[] memory;
-        memory = nullptr;
+    void Halt(){    //Stops every hart, e.g. once one of them exits or faults
+        for(auto flag : running) *flag = false;
+        idle.Notify();
     }
 
-    bool Check_Permission(uint32_t addr, int required_perm) {   //Checks the permission for a Given Memory address
+    Console_Output& Console(){ return uart->output; }   //Guest output: UART, write ecall, trace dumps
+
+    bool Check_Permission(uint32_t addr, uint32_t required_perm) {   //Checks the permission for a Given Memory address
         for(const auto& seg : memory_map){
             if(addr >= seg.start && addr < seg.end){
                 if((seg.flags & required_perm) == required_perm) return true;
@@ -177,68 +355,231 @@ struct RISC_V
 
         if (addr == 0) return false;
 
-        if(addr >= (MEM_Offset + MAX_MEMORY - 0x10000) && addr < (MEM_Offset + MAX_MEMORY)){
+        if(addr >= (dram.base + dram.size - stack_window) && addr < (dram.base + dram.size)){
             if((6 & required_perm) == required_perm) return true;   //Checking for stack memory
         }
 
+        for(const auto& region : extra_ram){
+            if(region.Contains(addr, 1)) return (6 & required_perm) == required_perm;
+        }
+
         return false;
     }
 
+    void Build_Page_Table(){    //Flattens memory_map and the stack window into page_attr
+        page_attr.assign(1u << (32 - PAGE_SHIFT), 0);
+
+        for(uint32_t local = 0; local < dram.size; local += PAGE_SIZE){
+            page_attr[(dram.base + local) >> PAGE_SHIFT] = Byte_Attr(dram.base + local);
+        }
+        for(const auto& region : extra_ram){
+            for(uint32_t local = 0; local < region.size; local += PAGE_SIZE){
+                page_attr[(region.base + local) >> PAGE_SHIFT] = Byte_Attr(region.base + local);
+            }
+        }
+
+        //A page is only uniform if no segment, the stack window or the null byte starts or ends inside it
+        std::vector<uint32_t> edges = {0, 1, dram.base + dram.size - stack_window};
+        for(const auto& seg : memory_map){
+            edges.push_back(seg.start);
+            edges.push_back(seg.end);
+        }
+        for(uint32_t edge : edges){
+            uint32_t offset = edge - dram.base;
+            if(offset >= dram.size || (edge & (PAGE_SIZE - 1)) == 0) continue;
+
+            Mixed_Page*& page = mixed_pages[offset >> PAGE_SHIFT];
+            if(page) continue;
+            page = new Mixed_Page();
+            uint32_t base = edge & ~(PAGE_SIZE - 1);
+            for(uint32_t i = 0; i < PAGE_SIZE; i++) page->attr[i] = Byte_Attr(base + i);
+            page_attr[edge >> PAGE_SHIFT] |= PAGE_MIXED;
+        }
+
+        for(const auto& m : bus.mappings){
+            for(uint64_t page = m.start >> PAGE_SHIFT; page <= (uint64_t)(m.end - 1) >> PAGE_SHIFT; page++){
+                page_attr[page] |= PAGE_MMIO;
+            }
+        }
+    }
+
+    uint8_t Byte_Attr(uint32_t addr){
+        uint8_t attr = 0;
+        if(Check_Permission(addr, PAGE_X)) attr |= PAGE_X;
+        if(Check_Permission(addr, PAGE_W)) attr |= PAGE_W;
+        if(Check_Permission(addr, PAGE_R)) attr |= PAGE_R;
+        return attr;
+    }
+
+    //Page_Attr bits that hold for every byte of [addr, addr + size); the span must not cross a page
+    uint8_t Span_Attr(uint32_t addr, uint32_t size){
+        uint8_t attr = page_attr[addr >> PAGE_SHIFT];
+        if(attr & PAGE_MIXED){
+            const uint8_t* bytes = mixed_pages[(addr - dram.base) >> PAGE_SHIFT]->attr;
+            uint32_t first = addr & (PAGE_SIZE - 1);
+            attr = (attr & PAGE_MMIO) | (bytes[first] & bytes[first + size - 1]);
+        }
+        return attr;
+    }
+
+    bool Access_Allowed(uint32_t addr, uint32_t size, int required_perm){ //Checks the first and last byte of an access
+        uint32_t last = addr + size - 1;
+        if((last >> PAGE_SHIFT) == (addr >> PAGE_SHIFT)){
+            return (Span_Attr(addr, size) & required_perm) == required_perm; //Common case: one lookup
+        }
+        return (Span_Attr(addr, 1) & Span_Attr(last, 1) & required_perm) == required_perm;
+    }
+
+    //Whether every byte of [addr, addr + size) is RAM with required_perm, for buffers handed over
+    //whole; unlike Access_Allowed it looks at the pages and bytes in between as well
+    bool Range_Allowed(uint32_t addr, uint32_t size, int required_perm){
+        if(size == 0 || (uint64_t)addr + size > 0x100000000ull) return size == 0;
+        uint64_t end = (uint64_t)addr + size;
+        for(uint64_t at = addr; at < end;){
+            uint64_t page_end = std::min(end, (at | (PAGE_SIZE - 1)) + 1);
+            uint8_t attr = page_attr[at >> PAGE_SHIFT];
+            if(attr & PAGE_MMIO) return false;
+            if(attr & PAGE_MIXED){
+                const uint8_t* bytes = mixed_pages[(at - dram.base) >> PAGE_SHIFT]->attr;
+                for(uint64_t byte = at; byte < page_end; byte++){
+                    if((bytes[byte & (PAGE_SIZE - 1)] & required_perm) != required_perm) return false;
+                }
+            }
+            else if((attr & required_perm) != required_perm) return false;
+            at = page_end;
+        }
+        return true;
+    }
+
+    bool Allocate_Ram(){    //Reserves dram and extra_ram once their bases are known
+        if((uint64_t)dram.base + dram.size > 0x100000000ull || (dram.base & (PAGE_SIZE - 1))){
+            *errors << "Error: RAM at 0x" << std::hex << dram.base << std::dec << " does not fit the address space." << std::endl;
+            return false;
+        }
+        if(stack_window > dram.size){
+            *errors << "Error: RAM too small for the stacks of every hart." << std::endl;
+            return false;
+        }
+
+        for(size_t i = 0; i < extra_ram.size(); i++){
+            bool clash = extra_ram[i].Overlaps(dram);
+            for(size_t j = 0; j < i; j++) clash |= extra_ram[i].Overlaps(extra_ram[j]);
+            if(clash){
+                *errors << "Error: RAM region at 0x" << std::hex << extra_ram[i].base << std::dec << " overlaps another region." << std::endl;
+                return false;
+            }
+        }
+
+        bool ok = dram.Allocate();
+        for(auto& region : extra_ram) ok = ok && region.Allocate();
+        if(!ok){
+            *errors << "Error: Could not reserve guest RAM." << std::endl;
+            return false;
+        }
+
+        mixed_pages.assign(dram.size >> PAGE_SHIFT, nullptr);
+        return true;
+    }
+
+    Ram_Region* Find_Ram(uint32_t addr, uint32_t size){ //Region holding all of [addr, addr + size), if any
+        if(dram.Contains(addr, size)) return &dram;
+        for(auto& region : extra_ram){
+            if(region.Contains(addr, size)) return &region;
+        }
+        return nullptr;
+    }
+
+    uint8_t* Host_Address(uint32_t addr, uint32_t size){    //Host copy of guest RAM, nullptr unless the range is inside one region
+        Ram_Region* region = Find_Ram(addr, size);
+        return region ? region->host + (addr - region->base) : nullptr;
+    }
+
+    //Copies a segment's file bytes into dram. Whole pages of read-only segments are mapped
+    //copy-on-write from the file instead, so instances running the same binary share them.
+    void Load_Segment(Mapped_File& file, const Elf32_Phdr& phdr, uint32_t local_addr){
+        uint32_t done = 0;
+
+        bool shareable = !(phdr.p_flags & 2) && ((phdr.p_offset ^ phdr.p_vaddr) & (PAGE_SIZE - 1)) == 0;
+        if(shareable){
+            uint32_t head = (PAGE_SIZE - (phdr.p_vaddr & (PAGE_SIZE - 1))) & (PAGE_SIZE - 1);
+            if(head < phdr.p_filesz){
+                uint32_t whole = (phdr.p_filesz - head) & ~(PAGE_SIZE - 1);
+                if(whole && file.Map_Private(&dram.host[local_addr + head], phdr.p_offset + head, whole)){
+                    std::memcpy(&dram.host[local_addr], file.data + phdr.p_offset, head);
+                    done = head + whole;
+                }
+            }
+        }
+
+        std::memcpy(&dram.host[local_addr + done], file.data + phdr.p_offset + done, phdr.p_filesz - done);
+    }
+
     //Reads a file parses it and Loads the program into the memory;
     bool LOAD_FILE(std::string FileName) {
-        std::ifstream file(FileName, std::ios::binary);
-        if(!file.is_open()) return false;
+        Mapped_File file;
+        if(!file.Open(FileName)) return false;
 
         Elf32_Ehdr header;
 
-        file.read(reinterpret_cast<char*>(&header), sizeof(Elf32_Ehdr));
+        if(!file.Contains(0, sizeof(Elf32_Ehdr))){
+            *errors<<"Error: Not a valid ELF file."<<std::endl;
+            return false;
+        }
+        std::memcpy(&header, file.data, sizeof(Elf32_Ehdr));
 
         if (header.e_ident[0] != 0x7F || header.e_ident[1] != 'E' 
             || header.e_ident[2] != 'L' || header.e_ident[3] != 'F') {
-                std::cerr<<"Error: Not a valid ELF file."<<std::endl;
+                *errors<<"Error: Not a valid ELF file."<<std::endl;
                 return false;
             }
         if(header.e_machine != 0xF3){
-            std::cerr << "Error: Not a RISC-V architecture file." << std::endl;
+            *errors << "Error: Not a RISC-V architecture file." << std::endl;
             return false;
         }
 
-        PC = header.e_entry;
-        Elf32_Phdr phdr;
+        entry = header.e_entry;
+        std::vector<Elf32_Phdr> phdrs(header.e_phnum);
+
+        for(int i = 0; i < header.e_phnum; i++) {   //Program headers are parsed straight from the mapping
+            uint64_t at = header.e_phoff + (uint64_t)i * header.e_phentsize;
+            if(!file.Contains(at, sizeof(Elf32_Phdr))){
+                *errors << "Error: Truncated ELF file." << std::endl;
+                return false;
+            }
+            std::memcpy(&phdrs[i], file.data + at, sizeof(Elf32_Phdr));
+        }
 
         uint32_t lowest_vaddr = 0xFFFFFFFF;
 
         //Calculating the lowest virtual address to Set Memory Offset in order to fit inside the given memory
-        for(int i = 0; i < header.e_phnum; i++) {
-            file.seekg(header.e_phoff + (i * header.e_phentsize));
-            file.read(reinterpret_cast<char*>(&phdr), sizeof(Elf32_Phdr));
+        for(const auto& phdr : phdrs) {
             if (phdr.p_type == 1 && phdr.p_vaddr < lowest_vaddr) {
                 lowest_vaddr = phdr.p_vaddr;
             }
         }
 
-        MEM_Offset = lowest_vaddr; 
-
-        regs[2] = MEM_Offset + MAX_MEMORY - 4;// Setting the regs[2] to End of Memmory
-
-        for(int i=0 ; i<header.e_phnum ; i++){
-
-            file.seekg(header.e_phoff + (i * header.e_phentsize));
-            file.read(reinterpret_cast<char*>(&phdr), sizeof(Elf32_Phdr));
+        if(dram_auto_base) dram.base = lowest_vaddr & ~(PAGE_SIZE - 1);   //Regions are page-aligned; -N links need not be
+        if(!Allocate_Ram()) return false;
 
+        for(const auto& phdr : phdrs){
 
             if(phdr.p_type == 1){// Only loads a phdr data into memory if p_type = 1
 
-                if (phdr.p_vaddr < MEM_Offset){
-                    std::cerr << "Error: Segment address 0x" << std::hex << phdr.p_vaddr 
-                            << " is below MEM_Offset 0x" << MEM_Offset << std::dec << std::endl;
+                if (phdr.p_vaddr < dram.base){
+                    *errors << "Error: Segment address 0x" << std::hex << phdr.p_vaddr 
+                            << " is below the RAM base 0x" << dram.base << std::dec << std::endl;
                     return false;
                 }
 
-                uint32_t local_addr = phdr.p_vaddr - MEM_Offset;//Calculates the local address using Memory Offset
+                uint32_t local_addr = phdr.p_vaddr - dram.base;//Calculates the local address using Memory Offset
                 
-                if(local_addr + phdr.p_memsz > MAX_MEMORY) {
-                    std::cerr << "Error: Segment too large for emulator memory." << std::endl;
+                if((uint64_t)local_addr + phdr.p_memsz > dram.size || phdr.p_filesz > phdr.p_memsz) {
+                    *errors << "Error: Segment too large for emulator memory." << std::endl;
+                    return false;
+                }
+
+                if(!file.Contains(phdr.p_offset, phdr.p_filesz)){
+                    *errors << "Error: Truncated ELF file." << std::endl;
                     return false;
                 }
 
@@ -248,32 +589,218 @@ struct RISC_V
                 seg.flags = phdr.p_flags;
                 memory_map.push_back(seg);
 
-                file.seekg(phdr.p_offset);
-                file.read(reinterpret_cast<char*>(&memory[local_addr]), phdr.p_filesz);
-
-                if(phdr.p_memsz > phdr.p_filesz) {
-                    std::memset(&memory[local_addr + phdr.p_filesz], 0, phdr.p_memsz-phdr.p_filesz);
-                }
+                Load_Segment(file, phdr, local_addr);
+                //The rest up to p_memsz (.bss) is already zero: fresh pages come zero-filled
             }
         }
+
+        Load_Symbols(file, header);
+        Build_Page_Table();
         return true;
     }
 
-    //Fetches a 32 bit word
-    uint32_t FETCH()
+    //Collects functions (and global labels, like an assembly _start) in executable sections from
+    //.symtab. Stripped or odd files just leave the table empty; the profiler then prints addresses.
+    void Load_Symbols(Mapped_File& file, const Elf32_Ehdr& header){
+        std::vector<Elf32_Shdr> shdrs(header.e_shnum);
+        for(int i = 0; i < header.e_shnum; i++){
+            uint64_t at = header.e_shoff + (uint64_t)i * header.e_shentsize;
+            if(header.e_shentsize < sizeof(Elf32_Shdr) || !file.Contains(at, sizeof(Elf32_Shdr))) return;
+            std::memcpy(&shdrs[i], file.data + at, sizeof(Elf32_Shdr));
+        }
+
+        for(const auto& symtab : shdrs){
+            if(symtab.sh_type != 2 || symtab.sh_link >= shdrs.size()) continue;
+            const Elf32_Shdr& strtab = shdrs[symtab.sh_link];
+            if(!file.Contains(symtab.sh_offset, symtab.sh_size) || !file.Contains(strtab.sh_offset, strtab.sh_size)) return;
+
+            for(uint32_t at = 0; at + sizeof(Elf32_Sym) <= symtab.sh_size; at += sizeof(Elf32_Sym)){
+                Elf32_Sym sym;
+                std::memcpy(&sym, file.data + symtab.sh_offset + at, sizeof(Elf32_Sym));
+                uint32_t type = sym.st_info & 0xF, binding = sym.st_info >> 4;
+                bool code = sym.st_shndx > 0 && sym.st_shndx < shdrs.size() && (shdrs[sym.st_shndx].sh_flags & 4);
+                if(!code || sym.st_name >= strtab.sh_size || !(type == 2 || (type == 0 && binding != 0))) continue;
+
+                const char* name = reinterpret_cast<const char*>(file.data + strtab.sh_offset + sym.st_name);
+                symbols.Add(sym.st_value, sym.st_size, std::string(name, strnlen(name, strtab.sh_size - sym.st_name)));
+            }
+        }
+        symbols.Sort();
+    }
+
+};
+
+struct RISC_V
+{
+    Machine& machine;   //RAM, permission tables and devices shared with the other harts
+    Ram_Region& dram;   //machine.dram, kept at hand for the memory fast paths
+    uint32_t hart_id;
+
+    uint32_t regs[32];
+    uint32_t PC;
+    std::atomic<bool> running;  //Cleared by this hart or, through Machine::Halt, by another one
+    Core_Kind core = JIT_SUPPORTED ? CORE_JIT : CORE_SWITCH;   //Execution core used by RUN_HART
+
+    uint32_t csrs[4096]; // CSR registers
+
+    const uint32_t MCYCLE_L   = 0xB00; // machine cycle counter (low)
+    const uint32_t MCYCLE_H   = 0xB80; // machine cycle counter (high)
+    const uint32_t MINSTRET_L  = 0xB02; // instructions retired (low)
+    const uint32_t MINSTRET_H = 0xB82; // instructions retired (high)
+    const uint32_t CYCLE = 0xC00;   // read-only shadows of mcycle, mtime and minstret (+0x80: high)
+    const uint32_t TIME = 0xC01;
+    const uint32_t INSTRET = 0xC02;
+    const uint32_t MHARTID = 0xF14; // hart id (read only)
+    const uint32_t MISA = 0x301;    // RV32IMAC (read only here: extensions can't be switched off)
+    const uint32_t MCOUNTINHIBIT = 0x320;   // stops mcycle (bit 0), minstret (bit 2), mhpmcounter n (bit n)
+    const uint32_t MHPMEVENT = 0x320;   // + n: event mhpmcounter n counts (3 .. 31)
+
+    uint64_t cycle_count = 0;   //cycles executed
+    uint64_t inst_count = 0;    //instructions executed;
+
+    //Counter CSRs are never stored: reads derive them from a source count (cycle_count,
+    //inst_count or the mhpmevent-selected event), guest writes move these offsets instead.
+    //Index n is mcycle (0), minstret (2) or mhpmcounter n.
+    uint64_t counter_offset[32] = {};   //Counter - source
+    uint64_t counter_frozen[32] = {};   //Value held while its mcountinhibit bit is set
+    uint64_t hpm_events[HPM_COUNTED] = {};
+    uint64_t time_offset = 0;   //mtime - cycle_count
+    std::unique_ptr<Branch_Model> predictor{Make_Predictor(BP_BIMODAL)};   //Cores are instantiated for its unit type
+    std::unique_ptr<Cache_Hierarchy> caches;    //--cache timing model, null when off
+
+    TraceRecord trace_buffer[TRACE_SIZE];   //Flight recorder
+    int trace_index = 0;
+    bool trace_full = false;
+    std::unique_ptr<Trace_Stream> trace_stream;  //--trace: gets every full ring of the flight recorder
+    std::unique_ptr<Profiler> profiler; //--profile: sampled at its next_sample like a pause
+
+    std::atomic<uint64_t> mtimecmp{0xffffffffffffffff}; //Alarm time, written by any hart through the CLINT
+    std::atomic<bool> mtip_clear{false};    //A CLINT write asked for mip.MTIP to be cleared
+    std::atomic<uint32_t> msip{0};  //CLINT software interrupt, raised by any hart
+    std::atomic<uint64_t> next_event{0};    //cycle_count at which Service_Events has to run next
+    uint32_t mtvec = 0; //Address of the interrupt handler
+    uint32_t mepc = 0;  //Old PC (return after interrupt)
+    uint32_t mcause = 0;    //Cause of interrupt
+    uint32_t mstatus = 0;   //machine status
+
+    bool reserved = false;  //LR.W reservation, checked by SC.W
+    uint32_t reserved_addr = 0;
+    uint32_t reserved_val = 0;
+
+    uint64_t pause_at = UINT64_MAX; //inst_count at which the cores stop: next snapshot or the limit
+    uint64_t inst_limit = UINT64_MAX;   //--limit: stop the machine after this many instructions
+    uint64_t realtime_hz = 0;   //--realtime: WFI sleeps the host, cycles per second; 0 = virtual time
+    uint64_t snapshot_at = UINT64_MAX;  //--snapshot-at, then advanced by snapshot_every
+    bool paused = false;    //The core stopped because of pause_at, not because the guest ended
+    std::string snapshot_path;  //--snapshot: first file, later ones get .1, .2, ...
+    uint64_t snapshot_every = 0;    //Instructions between incremental snapshots, 0 = just one
+    uint32_t snapshots_taken = 0;
+    std::string snapshot_parent;    //Last snapshot written or restored; the next one builds on it
+    std::string restore_path;   //--restore: start from this snapshot instead of an ELF
+
+    std::vector<Decoded_Page*> decode_cache;    //Decoded pages indexed by DRAM page, filled lazily
+    Decoded_Instruction uncached_inst;  //Holds decodes that can't be cached (misaligned PC)
+
+    //Translated-block tiers (JIT and micro-op IR)
+    Jit_Code_Cache jit_cache;
+    Jit_Layout jit_layout;
+    Block_Cache<Jit_Block> jit_blocks;
+    Block_Cache<Ir_Block> ir_blocks;
+    uint32_t block_pc = 0;  //Address of the next instruction of the running block Block_Sync accounts for
+    const uint32_t* block_raw = nullptr;    //Its guest words and parcels
+    uint32_t block_count = 0;   //Its length
+    uint32_t block_synced = 0;  //Instructions of it already accounted for
+    bool block_exit = false;    //Set when the running block has to stop early
+
+    RISC_V(Machine& machine, uint32_t hart_id) : machine(machine), dram(machine.dram), hart_id(hart_id)
+    {
+        //Setting all registers to 0
+        for(int i=0 ; i<32 ; i++) {
+            regs[i] = 0;
+        }
+       
+        PC = 0; //The Program counter starts at the begging of memory
+
+        running = false;
+
+        for(int i=0; i<4096; i++) csrs[i] = 0;
+        csrs[MHARTID] = hart_id;
+        csrs[MISA] = (1u << 30) | (1 << ('A' - 'A')) | (1 << ('C' - 'A')) | (1 << ('I' - 'A')) | (1 << ('M' - 'A'));
+
+        if(machine.clint->harts.size() <= hart_id) machine.clint->harts.resize(hart_id + 1);
+        machine.clint->harts[hart_id] = Clint_Hart{&mtimecmp, &mtip_clear, &msip, &next_event, &cycle_count, &time_offset};
+        if(hart_id == 0) machine.uart->rx_event = &next_event;
+        machine.running.push_back(&running);
+    }
+
+    ~RISC_V(){
+        for(auto page : decode_cache) delete page;
+    }
+
+    void Reset(){   //Puts the hart at the entry point with its own stack, once RAM is loaded
+        PC = machine.entry;
+        regs[2] = dram.base + dram.size - 4 - hart_id * HART_STACK_SIZE;    // Setting the regs[2] to End of Memmory
+        decode_cache.assign(dram.size >> PAGE_SHIFT, nullptr);
+        running = true;
+    }
+
+    void Log_Trace(uint32_t pc, uint32_t raw){  //Logs traces using circular logic
+        trace_buffer[trace_index].pc = pc;
+        trace_buffer[trace_index].raw = raw;
+
+        trace_index = (trace_index + 1) % TRACE_SIZE;
+        if(trace_index == 0){   //Only checked once per ring, so a run without --trace pays nothing extra
+            trace_full = true;
+            if(trace_stream) trace_stream->Append(trace_buffer, TRACE_SIZE);
+        }
+    }
+
+    void Dump_Trace(){  //Dumps trace duh!
+        std::ostringstream out;
+        out<<"\n|| Trace Dump ||\n";
+        if(machine.running.size() > 1) out<<"Hart "<<hart_id<<"\n";
+        out<<"---------------------------------\n";
+
+        int start = trace_full ? trace_index : 0;
+        int count = trace_full ? TRACE_SIZE : trace_index;
+
+        for(int i=0; i<count ; i++){
+            int idx = (start + i) % TRACE_SIZE;
+            out<<"PC: 0x"<<std::hex<<trace_buffer[idx].pc<<" | Inst: 0x"<<trace_buffer[idx].raw<<std::dec<<std::endl;
+        }
+        out<<"---------------------------------\n";
+        machine.Console().Write(hart_id, out.str());
+    }
+
+    void Fault(const char* access){ //Segmentation fault: report, dump the flight recorder and stop
+        machine.Console().Flush();  //Whatever the guest printed comes before the error
+        *machine.errors << "Fatal Error: Segmentation Fault (" << access << ")" << std::endl;
+        machine.errors->flush();
+        Dump_Trace();
+        machine.Console().Flush();
+        machine.faulted = true;
+        running = false;
+    }
+
+    //Fetches one instruction: a 16 bit parcel, and the second one unless the first is compressed
+    uint32_t FETCH(uint32_t pc)
     {
-        if(PC - MEM_Offset >= MAX_MEMORY || PC < MEM_Offset) return 0;
+        if(!dram.Contains(pc, 2)) return 0;
         uint32_t word = 0;
-        word |= memory[PC - MEM_Offset];
-        word |= memory[PC + 1 - MEM_Offset] << 8;
-        word |= memory[PC + 2 - MEM_Offset] << 16;
-        word |= memory[PC + 3 - MEM_Offset] << 24;
+        word |= dram.host[pc - dram.base];
+        word |= dram.host[pc + 1 - dram.base] << 8;
+        if(INST_LENGTH(word) == 2) return word;
+
+        if(!dram.Contains(pc, 4)) return 0;
+        word |= dram.host[pc + 2 - dram.base] << 16;
+        word |= dram.host[pc + 3 - dram.base] << 24;
         return word;
     }
 
     //Decodes the raw binary code into instructions
     Decoded_Instruction DECODE(uint32_t raw){
-        Decoded_Instruction inst;   //stores the decoded instructions
+        if(INST_LENGTH(raw) == 2) raw = EXPAND_COMPRESSED(raw); //RVC: decode the 32 bit instruction it stands for
+        Decoded_Instruction inst{}; //stores the decoded instructions
         inst.opcode = raw & 0x7F;   //Contains the opcode to specify the instruction type
         inst.rd = (raw >> 7) & 0x1F;    //stores the address of destination register
         inst.func3 = (raw >> 12) & 0x07;    //use to diffrentiate between instructions
@@ -320,148 +847,196 @@ struct RISC_V
                 break;
         } 
 
+        inst.op = RESOLVE_OP(inst);
         return inst;
     }
 
-    uint32_t READ_32(uint32_t addr){  //Reads a complete word from the memory
-
-        uint64_t current_time = ((uint64_t)csrs[MCYCLE_H] << 32) | csrs[MCYCLE_L];
+    //Returns the decoded instruction at pc, decoding it only the first time it is seen
+    Decoded_Instruction* FETCH_DECODED(uint32_t pc){
+        uint32_t offset = pc - dram.base;
 
-        if (addr == 0x0200BFF8) return (uint32_t)(current_time & 0xFFFFFFFF);   //higher 32 bits
+        if(offset < dram.size && (pc & 1) == 0){
+            Decoded_Page*& page = decode_cache[offset >> PAGE_SHIFT];
+            if(page){
+                Decoded_Instruction& entry = page->inst[(offset & (PAGE_SIZE - 1)) >> 1];
+                if(entry.valid) return &entry;  //Hit: permission was checked when it was filled
+            }
 
-        if (addr == 0x0200BFFC) return (uint32_t)(current_time >> 32);  //lower 32 bits
+            uint32_t raw = FETCH(pc);
+            if(!machine.Access_Allowed(pc, INST_LENGTH(raw), PAGE_X)) return nullptr;
 
-        if(addr + 3 - MEM_Offset >= MAX_MEMORY){
-            return 0;
+            if(!page) page = new Decoded_Page();
+            Decoded_Instruction& entry = page->inst[(offset & (PAGE_SIZE - 1)) >> 1];
+            entry = DECODE(raw);
+            entry.raw = raw;
+            entry.valid = DECODED_VALID;
+            return &entry;
         }
 
-        if(!Check_Permission(addr, 4) || !Check_Permission(addr + 3, 4)){   //Read Permission Check
-            std::cerr << "Fatal Error: Segmentation Fault (Read)" << std::endl;
-            Dump_Trace();
-            running = false;
-            return 0;
-        }
+        uint32_t raw = FETCH(pc);
+        if(!machine.Access_Allowed(pc, INST_LENGTH(raw), PAGE_X)) return nullptr;
 
-        uint32_t word = (uint32_t)memory[addr - MEM_Offset] | 
-                        ((uint32_t)memory[addr + 1 - MEM_Offset] << 8) | 
-                        ((uint32_t)memory[addr + 2 - MEM_Offset] << 16) | 
-                        ((uint32_t)memory[addr + 3 - MEM_Offset] << 24);
-        return word;
+        uncached_inst = DECODE(raw);
+        uncached_inst.raw = raw;
+        return &uncached_inst;
     }
 
-    uint16_t READ_16(uint32_t addr){  //Reads a half word from the memory
-        if(addr + 1 - MEM_Offset >= MAX_MEMORY){
-            return 0;
+    void Invalidate_Decoded(uint32_t addr, uint32_t size){  //Drops decoded instructions overlapping a guest store
+        uint32_t offset = addr - dram.base;
+        if(offset >= dram.size) return;    //extra_ram is never executed
+        uint32_t last = std::min(offset + size - 1, dram.size - 1);
+
+        //Every halfword the store touches, and the one before it: a 32 bit instruction there overlaps too
+        for(uint32_t half = (offset & ~1u) - (offset >= 2 ? 2 : 0); half <= last; half += 2){
+            Decoded_Page* page = decode_cache[half >> PAGE_SHIFT];
+            if(!page) continue;
+            Decoded_Instruction& entry = page->inst[(half & (PAGE_SIZE - 1)) >> 1];
+            if(half + INST_LENGTH(entry.raw) > offset) Invalidate_Slot(entry, addr, size);
         }
+    }
 
-        if(!Check_Permission(addr, 4) || !Check_Permission(addr + 1, 4)){   //Read Permission Check
-            std::cerr << "Fatal Error: Segmentation Fault (Read)" << std::endl;
-            Dump_Trace();
-            running = false;
-            return 0;
+    void Invalidate_Slot(Decoded_Instruction& entry, uint32_t addr, uint32_t size){
+        if(entry.valid & DECODED_BLOCK) Blocks_Invalidate(addr, size);
+        entry.valid = 0;
+    }
+
+    void Flush_Decode_Cache(){  //FENCE.I: forget every decoded instruction
+        for(auto page : decode_cache){
+            if(!page) continue;
+            for(auto& e : page->inst) e.valid = 0;
         }
+        Blocks_Flush();
+    }
 
-        uint16_t hword = (uint16_t)memory[addr - MEM_Offset] | 
-                         ((uint16_t)memory[addr + 1 - MEM_Offset] << 8);
-        return hword;
+    //Guest memory accessors. The fast path is one bounds check, one page table lookup and a
+    //single host-width access; MMIO pages, extra_ram and accesses that cross a page, leave
+    //dram or fault go through the byte-wise slow path.
+    void Cache_Data(uint32_t addr){ //Charges the data cache for an access that is not MMIO
+        if(!(machine.page_attr[addr >> PAGE_SHIFT] & PAGE_MMIO)) cycle_count += caches->Data(addr);
     }
 
-    uint8_t READ_8(uint32_t addr){  //Reads a byte from memory
+    template<typename T> T READ(uint32_t addr){
+        hpm_events[HPM_LOADS]++;
+        if(caches) Cache_Data(addr);
+        uint32_t offset = addr - dram.base;
 
-        if(addr == 0x10000005) { //Checks if a key is pressed or not
-            return _kbhit() ? 0x01 : 0x00;
+        if(offset <= dram.size - sizeof(T) && (addr & (PAGE_SIZE - 1)) <= PAGE_SIZE - sizeof(T)
+            && (machine.Span_Attr(addr, sizeof(T)) & (PAGE_R | PAGE_MMIO)) == PAGE_R){
+            T val;
+            std::memcpy(&val, &dram.host[offset], sizeof(T));
+            return Guest_Order(val);
         }
+        return READ_SLOW<T>(addr);
+    }
 
-        if(addr == 0x10000000) {    //If key is pressed reads the character and returns it
-            if(_kbhit()){
-                return _getch();
-            }
-            else{
-                return 0;
-            }
+    template<typename T> void WRITE(uint32_t addr, T val){
+        hpm_events[HPM_STORES]++;
+        if(caches) Cache_Data(addr);
+        uint32_t offset = addr - dram.base;
+
+        if(offset <= dram.size - sizeof(T) && (addr & (PAGE_SIZE - 1)) <= PAGE_SIZE - sizeof(T)
+            && (machine.Span_Attr(addr, sizeof(T)) & (PAGE_W | PAGE_MMIO)) == PAGE_W){
+            val = Guest_Order(val);
+            std::memcpy(&dram.host[offset], &val, sizeof(T));
+            dram.dirty[offset >> PAGE_SHIFT] = 1;
+            Invalidate_Decoded(addr, sizeof(T));
+            return;
+        }
+        WRITE_SLOW<T>(addr, val);
+    }
+
+    template<typename T> T READ_SLOW(uint32_t addr){
+        const uint32_t size = sizeof(T);
+
+        uint32_t mmio_val;
+        if((machine.page_attr[addr >> PAGE_SHIFT] & PAGE_MMIO) && machine.bus.Read(hart_id, addr, size, mmio_val)){
+            hpm_events[HPM_MMIO]++;
+            return (T)mmio_val;
         }
 
-        if (addr < MEM_Offset || addr - MEM_Offset >= MAX_MEMORY) {
+        uint8_t* host = machine.Host_Address(addr, size);
+        if(!host){
             return 0;
         }
 
-        if(!Check_Permission(addr, 4)){   //Read Permission Check
-            std::cerr << "Fatal Error: Segmentation Fault (Read)" << std::endl;
-            Dump_Trace();
-            running = false;
+        if(!machine.Access_Allowed(addr, size, PAGE_R)){   //Read Permission Check
+            Fault("Read");
             return 0;
         }
 
-        return memory[addr - MEM_Offset];
+        T val = 0;
+        for(uint32_t i = 0; i < size; i++){
+            val |= (T)host[i] << (8 * i);
+        }
+        return val;
     }
 
-    void WRITE_32(uint32_t addr, uint32_t val){ // Writes a word to memory
+    template<typename T> void WRITE_SLOW(uint32_t addr, T val){
+        const uint32_t size = sizeof(T);
 
-        if(addr == 0x02004000){//lower 32 bits
-            mtimecmp = (mtimecmp & 0xFFFFFFFF00000000) | (uint64_t)val;
-            return;
-        }
-        
-        if (addr == 0x02004004){//higher 32 bits
-            mtimecmp = (mtimecmp & 0x00000000FFFFFFFF) | ((uint64_t)val << 32);
-            csrs[0x344] &= ~(1 << 7); //clear pending bit
+        if((machine.page_attr[addr >> PAGE_SHIFT] & PAGE_MMIO) && machine.bus.Write(hart_id, addr, size, val)){
+            hpm_events[HPM_MMIO]++;
             return;
         }
 
-        if(addr + 3 - MEM_Offset >= MAX_MEMORY) return;
+        Ram_Region* region = machine.Find_Ram(addr, size);
+        if(!region) return;
+        uint8_t* host = region->host + (addr - region->base);
 
-        if(!Check_Permission(addr, 2) || !Check_Permission(addr + 3, 2)){   //Write Permission Check
-            std::cerr << "Fatal Error: Segmentation Fault (Write)" << std::endl;
-            Dump_Trace();
-            running = false;
+        if(!machine.Access_Allowed(addr, size, PAGE_W)){   //Write Permission Check
+            Fault("Write");
             return;
         }
 
-        memory[addr - MEM_Offset] = val & 0xFF;
-        memory[addr + 1 - MEM_Offset] = (val >> 8) & 0xFF;
-        memory[addr + 2 - MEM_Offset] = (val >> 16) & 0xFF;
-        memory[addr + 3 - MEM_Offset] = (val >> 24) & 0xFF;
+        for(uint32_t i = 0; i < size; i++){
+            host[i] = (uint8_t)(val >> (8 * i));
+        }
+        region->Mark_Dirty(addr, size);
+
+        Invalidate_Decoded(addr, size);
     }
 
-    void WRITE_16(uint32_t addr, uint32_t val){ // Writes a half word to memory
-        if(addr + 1 - MEM_Offset >= MAX_MEMORY) return;
+    uint32_t READ_32(uint32_t addr){ return READ<uint32_t>(addr); }  //Reads a complete word from the memory
+    uint16_t READ_16(uint32_t addr){ return READ<uint16_t>(addr); }  //Reads a half word from the memory
+    uint8_t READ_8(uint32_t addr){ return READ<uint8_t>(addr); }    //Reads a byte from memory
 
-        if(!Check_Permission(addr, 2) || !Check_Permission(addr + 1, 2)){   //Write Permission Check
-            std::cerr << "Fatal Error: Segmentation Fault (Write)" << std::endl;
-            Dump_Trace();
-            running = false;
-            return;
-        }
+    void WRITE_32(uint32_t addr, uint32_t val){ WRITE<uint32_t>(addr, val); }   // Writes a word to memory
+    void WRITE_16(uint32_t addr, uint32_t val){ WRITE<uint16_t>(addr, (uint16_t)val); }   // Writes a half word to memory
+    void WRITE_8(uint32_t addr, uint8_t val){ WRITE<uint8_t>(addr, val); }  // Writes a byte to memory
 
-        memory[addr - MEM_Offset] = val & 0xFF;
-        memory[addr + 1 - MEM_Offset] = (val >> 8) & 0xFF;
-    }
+    template<typename BP> BP& Predictor(){ return static_cast<BP&>(*predictor); }
 
-    void WRITE_8(uint32_t addr, uint8_t val) {  // Writes a byte to memory 
+    uint32_t INST_PC(const Decoded_Instruction& inst){ return PC - INST_LENGTH(inst.raw); }    //Address of inst while it executes
 
-        if (addr == UART_addr){
-            std::cout << (char)val; // Print to terminal
-            std::cout.flush();
-            return;
+    template<typename BP> void BRANCH(bool take, uint32_t pc, uint32_t target){  //Resolves the conditional branch at pc; PC already points past it
+        hpm_events[HPM_BRANCHES]++;
+        hpm_events[HPM_TAKEN_BRANCHES] += take;
+        if(BP::ENABLED && Predictor<BP>().Branch(pc, take, target)){
+            cycle_count += BRANCH_PENALTY; //Simulating pipeline flush due to misprediction
         }
 
-        if (addr < MEM_Offset || addr - MEM_Offset >= MAX_MEMORY) {
-            return;
+        if(take){
+            PC = target; //Executing the actual instruction
         }
+    }
 
-        if(!Check_Permission(addr, 2)){   //Write Permission Check
-            std::cerr << "Fatal Error: Segmentation Fault (Write)" << std::endl;
-            Dump_Trace();
-            running = false;
-            return;
-        }
+    template<typename BP> void BRANCH(bool take, const Decoded_Instruction& inst){  //Same, for the interpreter cores
+        uint32_t pc = INST_PC(inst);
+        BRANCH<BP>(take, pc, pc + inst.imm);
+    }
 
-        memory[addr - MEM_Offset] = val;
+    //JAL (rs1 = 0) or JALR at pc; link is the address after it, which rd receives
+    template<typename BP> void JUMP(uint32_t pc, uint32_t link, uint32_t target, uint32_t rd, uint32_t rs1){
+        hpm_events[HPM_JUMPS]++;
+        if(profiler) profiler->Jump(pc, link, target, rd, rs1);
+        if(BP::ENABLED && Predictor<BP>().Jump(pc, link, target, rd, rs1)){
+            cycle_count += BRANCH_PENALTY;
+        }
+        PC = target;
     }
-    
+
     //Executes the given instruction
-    void EXECUTE(Decoded_Instruction& inst){
-        bool branched = false;
+    template<typename BP> void EXECUTE(Decoded_Instruction& inst){
 
         switch(inst.opcode){
             case 0x03:
@@ -523,7 +1098,7 @@ struct RISC_V
                  }
                 break;
             case 0x17:  //AUIPC
-                regs[inst.rd] = (PC - 4) + inst.imm;
+                regs[inst.rd] = INST_PC(inst) + inst.imm;
 
                 break;
             case 0x23:
@@ -549,6 +1124,9 @@ struct RISC_V
                             case 0x20:  //SUB
                                 regs[inst.rd] = regs[inst.rs1] - regs[inst.rs2];
                                 break;
+                            case 0x01:  //MUL
+                                regs[inst.rd] = regs[inst.rs1] * regs[inst.rs2];
+                                break;
                         }
                         break;
                     case 0x1:
@@ -556,6 +1134,9 @@ struct RISC_V
                             case 0x00:  //SLL
                                 regs[inst.rd] = regs[inst.rs1] << (regs[inst.rs2] & 0x1F);
                                 break;
+                            case 0x01:  //MULH
+                                regs[inst.rd] = MULH(regs[inst.rs1], regs[inst.rs2]);
+                                break;
                         }
                         break;
                     case 0x2:
@@ -563,6 +1144,9 @@ struct RISC_V
                             case 0x00:  //SLT
                                 regs[inst.rd] = ((int32_t)regs[inst.rs1] < (int32_t)regs[inst.rs2]) ? 1 : 0;
                                 break;
+                            case 0x01:  //MULHSU
+                                regs[inst.rd] = MULHSU(regs[inst.rs1], regs[inst.rs2]);
+                                break;
                         }
                         break;
                     case 0x3:
@@ -570,6 +1154,9 @@ struct RISC_V
                             case 0x00:  //SLTU
                                 regs[inst.rd] = (regs[inst.rs1] < regs[inst.rs2]) ? 1 : 0;
                                 break;
+                            case 0x01:  //MULHU
+                                regs[inst.rd] = MULHU(regs[inst.rs1], regs[inst.rs2]);
+                                break;
                         }
                         break;
                     case 0x4:
@@ -577,6 +1164,9 @@ struct RISC_V
                             case 0x00:  //XOR
                                 regs[inst.rd] = regs[inst.rs1] ^ regs[inst.rs2];
                                 break;
+                            case 0x01:  //DIV
+                                regs[inst.rd] = DIV(regs[inst.rs1], regs[inst.rs2]);
+                                break;
                         }
                         break;
                     case 0x5:
@@ -587,6 +1177,9 @@ struct RISC_V
                             case 0x20:  //SRA
                                 regs[inst.rd] = (int32_t)regs[inst.rs1] >> (regs[inst.rs2] & 0x1F);
                                 break;
+                            case 0x01:  //DIVU
+                                regs[inst.rd] = DIVU(regs[inst.rs1], regs[inst.rs2]);
+                                break;
                         }
                         break;
                     case 0x6:
@@ -594,6 +1187,9 @@ struct RISC_V
                             case 0x00: //OR
                                 regs[inst.rd] = regs[inst.rs1] | regs[inst.rs2];
                                 break;
+                            case 0x01:  //REM
+                                regs[inst.rd] = REM(regs[inst.rs1], regs[inst.rs2]);
+                                break;
                         }
                         break;
                     case 0x7:
@@ -601,6 +1197,9 @@ struct RISC_V
                             case 0x00:  //AND
                                 regs[inst.rd] = regs[inst.rs1] & regs[inst.rs2];
                                 break;
+                            case 0x01:  //REMU
+                                regs[inst.rd] = REMU(regs[inst.rs1], regs[inst.rs2]);
+                                break;
                         }
                         break;
                  }
@@ -633,20 +1232,7 @@ struct RISC_V
                         break;
                 }
 
-                bool prediction = btb.predict(PC - 4);
-
-                if(prediction == take){
-                    btb.correct++;
-                }
-                else{
-                    cycle_count += 2; //Simulating pipeline flush due to misprediction
-                }
-
-                btb.update(PC - 4, take); //Updating the table
-
-                if(take){
-                    PC = (PC - 4) + inst.imm; //Executing the actual instruction
-                }
+                BRANCH<BP>(take, inst);
                 break;
             }
             case 0x67:
@@ -654,13 +1240,24 @@ struct RISC_V
                     case 0x0:   //JALR
                         uint32_t targ = (regs[inst.rs1] + inst.imm) & ~1;
                         regs[inst.rd] = PC;
-                        PC = targ;
+                        JUMP<BP>(INST_PC(inst), PC, targ, inst.rd, inst.rs1);
                         break;
                 }
                 break;
             case 0x6F:  //JAL
                 regs[inst.rd] = PC;
-                PC = (PC - 4) + inst.imm;
+                JUMP<BP>(INST_PC(inst), PC, INST_PC(inst) + inst.imm, inst.rd, 0);
+                break;
+            case 0x0F:
+                if(inst.func3 == 0x0){  //FENCE: order this hart's accesses against the other harts
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                }
+                if(inst.func3 == 0x1){  //FENCE.I
+                    Flush_Decode_Cache();
+                }
+                break;
+            case 0x2F:
+                ATOMIC(inst);
                 break;
             case 0x73:
                 if(inst.func3 == 0x0){
@@ -672,26 +1269,36 @@ struct RISC_V
                         mstatus &= ~(1 << 3);
                         mstatus |= (mpie_bit << 3);
                         mstatus |= (1 << 7);
+                        next_event.store(0, std::memory_order_relaxed);   //Interrupts may be enabled again
                     }
                     switch(inst.imm){
                         case 0x0:   //ECALL
                             switch(regs[17]){
-                                case 93:
-                                    std::cout<<"\n[Emulator] Program exited with code "<<regs[10]<<std::endl;
+                                case 93:    //exit: reported once the machine has stopped
+                                    machine.exit_code = regs[10];
+                                    machine.exited = true;
                                     running = false;
                                     break;
-                                case 64:
+                                case 64:    //write: stdout and stderr both go to the console
                                     if(regs[10] == 1 || regs[10] == 2){
-                                        for(uint32_t i = 0; i<regs[12]; i++){
-                                            char c = (char)READ_8(regs[11] + i);
-                                            std::cout << c;
+                                        uint32_t addr = regs[11], size = regs[12];
+                                        const uint8_t* bytes = machine.Range_Allowed(addr, size, PAGE_R) ? machine.Host_Address(addr, size) : nullptr;
+                                        if(bytes) machine.Console().Write(hart_id, (const char*)bytes, size);  //Checked once, one copy
+                                        else{   //MMIO or a bad buffer: byte by byte, faulting where the bad byte is
+                                            for(uint32_t i = 0; i < size && running; i++) machine.Console().Put(hart_id, (char)READ_8(addr + i));
                                         }
                                     }
                             }
                             break;
-                        case 0x1:   //EBREAK
-                            std::cout << "Breakpoint hit at PC: " << std::hex << (PC-4) << std::endl;
+                        case 0x105: //WFI
+                            WAIT_FOR_INTERRUPT();
                             break;
+                        case 0x1:{  //EBREAK
+                            std::ostringstream message;
+                            message << "Breakpoint hit at PC: " << std::hex << INST_PC(inst) << "\n";
+                            machine.Console().Write(hart_id, message.str());
+                            break;
+                        }
                     }
                     break;
                 }
@@ -703,6 +1310,7 @@ struct RISC_V
                     if(csr_addr == 0x305) old_val = mtvec;
                     if(csr_addr == 0x341) old_val = mepc;
                     if(csr_addr == 0x342) old_val = mcause;
+                    Read_Counter(csr_addr, old_val);
                     
                     if (inst.rd != 0) regs[inst.rd] = old_val;
 
@@ -733,105 +1341,1359 @@ struct RISC_V
                             new_val &= ~inst.rs1;
                             break;
                     }
-                    csrs[csr_addr] = new_val;
+                    //Bits 11:10 set mark read-only CSRs (cycle, time, instret, mhartid): writes are dropped, as are misa's
+                    if((csr_addr >> 10) != 3 && csr_addr != MISA && !Write_Counter(csr_addr, new_val)) csrs[csr_addr] = new_val;
 
                     if(csr_addr == 0x300) mstatus = new_val;
                     if(csr_addr == 0x305) mtvec = new_val;
                     if(csr_addr == 0x341) mepc = new_val;
                     if(csr_addr == 0x342) mcause = new_val;
                 }
+                next_event.store(0, std::memory_order_relaxed);   //mstatus, mie or mip may have changed
                 break;
             }
 
         regs[0] = 0;
     }
 
-    void checkInterrupt(){  //Runs every cycle and checks interrupts
+    //A extension (.W only). Every AMO is a compare-and-swap loop on the host word, so harts on
+    //other threads see it as one atomic access; SC.W succeeds if the word still holds the value
+    //its LR.W read.
+    void ATOMIC(Decoded_Instruction& inst){
+        uint32_t func5 = inst.func7 >> 2;
+        bool known = func5 <= 0x04 || func5 == 0x08 || func5 == 0x0C || ((func5 & 0x13) == 0x10);
+        if(inst.func3 != 0x2 || !known) return;
+
+        uint32_t addr = regs[inst.rs1];
+        if(caches) Cache_Data(addr);
+        uint32_t* host = Atomic_Host(addr, func5 == 0x02 ? PAGE_R : (PAGE_R | PAGE_W));
+        if(!host){
+            Fault("Atomic");
+            return;
+        }
+
+        if(func5 == 0x02){  //LR.W
+            reserved = true;
+            reserved_addr = addr;
+            reserved_val = Host_Load32(host);
+            regs[inst.rd] = Guest_Order(reserved_val);
+            return;
+        }
+
+        if(func5 == 0x03){  //SC.W
+            uint32_t expected = reserved_val;
+            bool done = reserved && reserved_addr == addr && Host_CAS32(host, expected, Guest_Order(regs[inst.rs2]));
+            reserved = false;
+            if(done) Atomic_Stored(addr);
+            regs[inst.rd] = done ? 0 : 1;
+            return;
+        }
 
-        uint64_t current_time = ((uint64_t)csrs[MCYCLE_H] << 32) | csrs[MCYCLE_L];
+        uint32_t src = regs[inst.rs2];
+        uint32_t seen = Host_Load32(host);
+        uint32_t old, val;
+        do{
+            old = Guest_Order(seen);
+            switch(func5){
+                case 0x01: val = src; break;    //AMOSWAP.W
+                case 0x00: val = old + src; break;  //AMOADD.W
+                case 0x04: val = old ^ src; break;  //AMOXOR.W
+                case 0x0C: val = old & src; break;  //AMOAND.W
+                case 0x08: val = old | src; break;  //AMOOR.W
+                case 0x10: val = (int32_t)old < (int32_t)src ? old : src; break;   //AMOMIN.W
+                case 0x14: val = (int32_t)old > (int32_t)src ? old : src; break;   //AMOMAX.W
+                case 0x18: val = old < src ? old : src; break;  //AMOMINU.W
+                default:   val = old > src ? old : src; break;  //AMOMAXU.W
+            }
+        } while(!Host_CAS32(host, seen, Guest_Order(val)));
+
+        Atomic_Stored(addr);
+        regs[inst.rd] = old;
+    }
 
-        if(current_time >= mtimecmp) {
+    uint32_t* Atomic_Host(uint32_t addr, int required_perm){   //Host word an AMO works on, nullptr if it faults
+        if((addr & 3) || (machine.page_attr[addr >> PAGE_SHIFT] & PAGE_MMIO)) return nullptr;
+
+        uint8_t* host = machine.Host_Address(addr, 4);
+        if(!host || !machine.Access_Allowed(addr, 4, required_perm)) return nullptr;
+        return reinterpret_cast<uint32_t*>(host);
+    }
+
+    void Atomic_Stored(uint32_t addr){  //Bookkeeping WRITE_SLOW does for plain stores
+        machine.Find_Ram(addr, 4)->Mark_Dirty(addr, 4);
+        Invalidate_Decoded(addr, 4);    //Other harts pick up code changes at their next FENCE.I
+    }
+
+    uint64_t Mtime(){ return cycle_count + time_offset; }    //CLINT mtime, also the time CSR
+
+    uint64_t Counter_Source(uint32_t n){    //What counter n follows while it is not inhibited
+        if(n == 0) return cycle_count;
+        if(n == 2) return inst_count;
+        switch(csrs[MHPMEVENT + n]){
+            case HPM_MISPREDICTS: return predictor->stats.mispredicts;
+            case HPM_L1I_MISSES: return caches ? caches->levels[CACHE_L1I].misses : 0;
+            case HPM_L1D_MISSES: return caches ? caches->levels[CACHE_L1D].misses : 0;
+            case HPM_L2_MISSES: return caches ? caches->levels[CACHE_L2].misses : 0;
+        }
+        uint32_t event = csrs[MHPMEVENT + n];
+        return event > HPM_NONE && event < HPM_COUNTED ? hpm_events[event] : 0;
+    }
+
+    uint64_t Counter_Value(uint32_t n){
+        if((csrs[MCOUNTINHIBIT] >> n) & 1) return counter_frozen[n];
+        return Counter_Source(n) + counter_offset[n];
+    }
+
+    void Set_Counter(uint32_t n, uint64_t value){
+        if((csrs[MCOUNTINHIBIT] >> n) & 1) counter_frozen[n] = value;
+        else counter_offset[n] = value - Counter_Source(n);
+    }
+
+    bool Read_Counter(uint32_t csr_addr, uint32_t& val){    //Derives a counter CSR, false for other CSRs
+        uint32_t low = csr_addr & ~0x80u;   //High halves sit 0x80 above the low ones
+        if((low & ~0x1Fu) != 0xB00 && (low & ~0x1Fu) != 0xC00) return false;   //mcycle..mhpmcounter31, cycle..hpmcounter31
+
+        uint32_t n = low & 0x1F;
+        uint64_t count;
+        if(n == 1){ //time; there is no machine-mode CSR in its slot
+            if(low != TIME) return false;
+            count = Mtime();
+        }
+        else count = Counter_Value(n);
+        val = (csr_addr & 0x80) ? (uint32_t)(count >> 32) : (uint32_t)count;
+        return true;
+    }
+
+    //Writes to mcycle, minstret, mhpmcounter3..31, mcountinhibit and mhpmevent3..31 keep every
+    //counter's value continuous; false for other CSRs
+    bool Write_Counter(uint32_t csr_addr, uint32_t val){
+        if(csr_addr == MCOUNTINHIBIT){
+            val &= ~2u; //No bit for time
+            uint64_t values[32];
+            for(uint32_t n = 0; n < 32; n++) values[n] = Counter_Value(n);
+            csrs[MCOUNTINHIBIT] = val;
+            for(uint32_t n = 0; n < 32; n++){
+                if(n != 1) Set_Counter(n, values[n]);
+            }
+            return true;
+        }
+        if(csr_addr > MHPMEVENT + 2 && csr_addr <= MHPMEVENT + 31){
+            uint32_t n = csr_addr - MHPMEVENT;
+            uint64_t value = Counter_Value(n);
+            csrs[csr_addr] = val;
+            Set_Counter(n, value);
+            return true;
+        }
+
+        uint32_t low = csr_addr & ~0x80u;
+        if((low & ~0x1Fu) != MCYCLE_L || low == 0xB01) return false;
+
+        uint32_t n = low & 0x1F;
+        uint64_t current = Counter_Value(n);
+        if(csr_addr & 0x80) current = (current & 0x00000000FFFFFFFF) | ((uint64_t)val << 32);
+        else current = (current & 0xFFFFFFFF00000000) | (uint64_t)val;
+        Set_Counter(n, current);
+        return true;
+    }
+
+    void checkInterrupt(){  //Runs at every event (see Schedule_Events) and checks interrupts
+
+        uint64_t current_time = Mtime();
+
+        if(current_time >= mtimecmp.load(std::memory_order_relaxed)) {
             csrs[0x344] |= (1 << 7);
         }
 
+        //Software interrupt pending bit mirrors this hart's CLINT msip, external the UART RX line
+        csrs[0x344] = (csrs[0x344] & ~(1u << 3)) | (msip.load(std::memory_order_relaxed) << 3);
+        csrs[0x344] = (csrs[0x344] & ~(1u << 11)) | ((hart_id == 0 && machine.uart->Rx_Interrupt()) << 11);
+
         bool g_enable = (mstatus >> 3) & 1; //Checking Global interrupt enable
         if(!g_enable) return;
 
+        bool soft_enable = (csrs[0x304] >> 3) & 1;  //Checking software interrupt enable
         bool timer_enable = (csrs[0x304] >> 7) & 1; //Checking timer interrupt enable
+        bool external_enable = (csrs[0x304] >> 11) & 1; //Checking external interrupt enable
 
+        bool soft_pending = (csrs[0x344] >> 3) & 1;
         bool timer_pending = (csrs[0x344] >> 7) & 1;
+        bool external_pending = (csrs[0x344] >> 11) & 1;
 
-        if(timer_enable && timer_pending){
+        if((soft_enable && soft_pending) || (timer_enable && timer_pending) || (external_enable && external_pending)){
             mepc = PC;// Saving the current PC
 
-            mcause = 0x80000007; //Setting the cause to Machine Timer Interrupt
+            //Setting the cause: Machine External, then Software, then Timer Interrupt
+            if(external_enable && external_pending) mcause = 0x8000000B;
+            else mcause = (soft_enable && soft_pending) ? 0x80000003 : 0x80000007;
 
             uint32_t mie_bit = (mstatus >> 3) & 1;
             mstatus &= ~(1 << 3);
             mstatus |= (mie_bit << 7);
+            reserved = false;   //A trap breaks any LR/SC sequence
+            hpm_events[HPM_TRAPS]++;
             
             PC = mtvec;// Jumping to handler
         }
     }
 
-    void RUN(std::string FileName){ // Runs the program loop and Instruction Cycle
-        if(!LOAD_FILE(FileName)) {
-            std::cerr<<"\nError: Cannot open file \""<<FileName<<"\"\n";
+    //WFI: idles until mip & mie is non-zero. In virtual time an armed timer makes the wait free:
+    //the clock jumps straight to mtimecmp. With --realtime the host thread sleeps for as long as
+    //those cycles take at realtime_hz instead, and the clock moves by the time that passed. Waits
+    //for msip or UART input (or a timer in real time) sleep until another thread zeroes
+    //next_event or stops the machine. A WFI nothing can end returns at once, as the spec allows.
+    void WAIT_FOR_INTERRUPT(){
+        uint32_t enabled = csrs[0x304] & ((1 << 11) | (1 << 7) | (1 << 3));
+        uint64_t now = Mtime();
+        uint64_t alarm = mtimecmp.load();
+        bool timer = (enabled & (1 << 7)) && alarm != UINT64_MAX;
+        if(!timer && !(enabled & ((1 << 11) | (1 << 3)))) return;
+
+        next_event.store(timer ? cycle_count + (alarm - std::min(now, alarm)) : UINT64_MAX);  //Non-zero: idle
+        uint32_t pending = (now >= alarm) << 7 | msip.load() << 3 | (hart_id == 0 && machine.uart->Rx_Interrupt()) << 11;
+        bool moved = mtimecmp.load() != alarm;  //Rewritten before the store above: its zero may be lost
+        if(!(pending & enabled) && !moved){
+            if(timer && realtime_hz == 0) cycle_count += alarm - now;
+            else Sleep_Until_Interrupt(timer ? alarm - now : UINT64_MAX);
+        }
+        next_event.store(0, std::memory_order_relaxed); //Whatever ended the wait gets serviced before the next instruction
+    }
+
+    void Sleep_Until_Interrupt(uint64_t cycles){    //cycles: until the timer fires, UINT64_MAX for none
+        std::unique_lock<std::mutex> lock(machine.idle.mutex);
+        auto woken = [this]{ return next_event.load() == 0 || !running; };
+        if(cycles == UINT64_MAX || realtime_hz == 0){
+            machine.idle.wake.wait(lock, woken);
             return;
         }
 
-        running = true;
+        auto start = std::chrono::steady_clock::now();
+        double seconds = std::min((double)cycles / realtime_hz, 1e9);
+        machine.idle.wake.wait_until(lock, start + std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(seconds)), woken);
+        double slept = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        cycle_count += std::min(cycles, (uint64_t)(slept * realtime_hz));
+    }
+
+    //Interrupts can only become due at a few points: the clock reaching mtimecmp, a CLINT write,
+    //a SYSTEM instruction (CSR write, MRET), a pause or a profiler sample. Each of them lowers
+    //next_event, so the cores compare one counter per instruction and run checkInterrupt only
+    //when it is reached.
+    void Schedule_Events(){
+        uint64_t next = UINT64_MAX;
+        uint64_t stop_at = profiler ? std::min(pause_at, profiler->next_sample) : pause_at;
+        if(stop_at != UINT64_MAX){  //cycle_count grows at least as fast as inst_count
+            next = stop_at > inst_count ? cycle_count + (stop_at - inst_count) : 0;
+        }
+        uint64_t alarm = mtimecmp.load();
+        if(!(csrs[0x344] & (1 << 7))){  //Timer: the cycle at which mtime reaches mtimecmp
+            uint64_t now = Mtime();
+            next = std::min(next, now >= alarm ? 0 : cycle_count + (alarm - now));
+        }
+
+        bool g_enable = (mstatus >> 3) & 1;
+        if(g_enable && (csrs[0x304] & csrs[0x344] & ((1 << 11) | (1 << 7) | (1 << 3)))) next = 0;  //Pending and enabled
+
+        next_event.store(next);
+
+        //msip, mtimecmp and the UART RX line are changed from other threads: set then zero next_event there,
+        //store then load here, so either this load sees the new state or the zero lands after the store above
+        if(mtimecmp.load() != alarm || mtip_clear.load()) next_event.store(0);
+        if(g_enable && ((csrs[0x304] >> 3) & 1) && msip.load()) next_event.store(0);
+        if(g_enable && ((csrs[0x304] >> 11) & 1) && hart_id == 0 && machine.uart->Rx_Interrupt()) next_event.store(0);
+    }
+
+    bool Service_Events(){  //next_event reached: sample, pause or check interrupts. False if the core must stop
+        if(mtip_clear.exchange(false)) csrs[0x344] &= ~(1u << 7);  //Posted by a CLINT write to mtimecmp
+        if(profiler && inst_count >= profiler->next_sample) profiler->Sample(PC, inst_count);
+        if(inst_count >= pause_at){ //Scheduled snapshot or --limit: stop the core on an instruction boundary
+            paused = true;
+            running = false;
+            return false;
+        }
+
+        checkInterrupt();
+        Schedule_Events();
+        return true;
+    }
+
+    //Runs the per-instruction front end shared by every core: interrupts, fetch, trace and counters
+    Decoded_Instruction* STEP_BEGIN(){
+        if(cycle_count >= next_event.load(std::memory_order_relaxed) && !Service_Events()) return nullptr;
+
+        Decoded_Instruction* inst = FETCH_DECODED(PC);
+
+        if(!inst){   //Address has no Execute Permission
+            Fault("Instruction Fetch");
+            return nullptr;
+        }
+
+        Log_Trace(PC, inst->raw); //Loggin Trace after each fetch
+        if(caches) cycle_count += caches->Fetch(PC);
 
+        PC += INST_LENGTH(inst->raw);
+
+        cycle_count++;
+        inst_count++;
+
+        return inst;
+    }
+
+    template<typename BP> void RUN_SWITCH(){  //Reference core: decode cache + nested switch
         while(running){
-            uint32_t current_pc = PC;
+            Decoded_Instruction* inst = STEP_BEGIN();
+            if(!inst) break;
 
-            checkInterrupt();
+            EXECUTE<BP>(*inst);
 
-            if(!Check_Permission(PC, 1)){   //Checking if address has Execute Permission
-                std::cerr << "Fatal Error: Segmentation Fault (Instruction Fetch)" << std::endl;
-                std::cerr.flush();
-                Dump_Trace();
+            if(PC - dram.base >= dram.size){
                 running = false;
-                break;
             }
+        }
+    }
 
-            uint32_t raw = FETCH();
-
-            Log_Trace(PC, raw); //Loggin Trace after each fetch
+    //Threaded core: every decoded instruction carries its concrete op, and each handler
+    //finishes by fetching the next instruction and jumping straight to its handler.
+    template<typename BP> void RUN_THREADED(){
+#if defined(__GNUC__)
+        static void* const handlers[OP_COUNT] = {
+            &&L_OP_GENERIC,
+            &&L_OP_LB, &&L_OP_LH, &&L_OP_LW, &&L_OP_LBU, &&L_OP_LHU,
+            &&L_OP_ADDI, &&L_OP_SLLI, &&L_OP_SLTI, &&L_OP_SLTIU, &&L_OP_XORI, &&L_OP_SRLI, &&L_OP_SRAI, &&L_OP_ORI, &&L_OP_ANDI,
+            &&L_OP_AUIPC,
+            &&L_OP_SB, &&L_OP_SH, &&L_OP_SW,
+            &&L_OP_ADD, &&L_OP_SUB, &&L_OP_SLL, &&L_OP_SLT, &&L_OP_SLTU, &&L_OP_XOR, &&L_OP_SRL, &&L_OP_SRA, &&L_OP_OR, &&L_OP_AND,
+            &&L_OP_MUL, &&L_OP_MULH, &&L_OP_MULHSU, &&L_OP_MULHU, &&L_OP_DIV, &&L_OP_DIVU, &&L_OP_REM, &&L_OP_REMU,
+            &&L_OP_LUI,
+            &&L_OP_BEQ, &&L_OP_BNE, &&L_OP_BLT, &&L_OP_BGE, &&L_OP_BLTU, &&L_OP_BGEU,
+            &&L_OP_JALR, &&L_OP_JAL
+        };
+        #define HANDLER(op) L_##op:
+        #define DISPATCH() \
+            regs[0] = 0; \
+            if(PC - dram.base >= dram.size) running = false; \
+            if(!running || !(inst = STEP_BEGIN())) return; \
+            goto *handlers[inst->op]
+#else
+        #define HANDLER(op) case op:
+        #define DISPATCH() \
+            regs[0] = 0; \
+            if(PC - dram.base >= dram.size) running = false; \
+            continue
+#endif
+        Decoded_Instruction* inst;
+
+#if defined(__GNUC__)
+        if(!running || !(inst = STEP_BEGIN())) return;
+        goto *handlers[inst->op];
+        {
+#else
+        while(running){
+            if(!(inst = STEP_BEGIN())) return;
+            switch(inst->op){
+#endif
+            HANDLER(OP_GENERIC) EXECUTE<BP>(*inst); DISPATCH();
+
+            HANDLER(OP_LB)  regs[inst->rd] = (int8_t)READ_8(regs[inst->rs1] + inst->imm); DISPATCH();
+            HANDLER(OP_LH)  regs[inst->rd] = (int16_t)READ_16(regs[inst->rs1] + inst->imm); DISPATCH();
+            HANDLER(OP_LW)  regs[inst->rd] = READ_32(regs[inst->rs1] + inst->imm); DISPATCH();
+            HANDLER(OP_LBU) regs[inst->rd] = READ_8(regs[inst->rs1] + inst->imm); DISPATCH();
+            HANDLER(OP_LHU) regs[inst->rd] = READ_16(regs[inst->rs1] + inst->imm); DISPATCH();
+
+            HANDLER(OP_ADDI)  regs[inst->rd] = regs[inst->rs1] + inst->imm; DISPATCH();
+            HANDLER(OP_SLLI)  regs[inst->rd] = regs[inst->rs1] << (inst->imm & 0x1F); DISPATCH();
+            HANDLER(OP_SLTI)  regs[inst->rd] = ((int32_t)regs[inst->rs1] < inst->imm) ? 1 : 0; DISPATCH();
+            HANDLER(OP_SLTIU) regs[inst->rd] = (regs[inst->rs1] < (uint32_t)inst->imm) ? 1 : 0; DISPATCH();
+            HANDLER(OP_XORI)  regs[inst->rd] = regs[inst->rs1] ^ inst->imm; DISPATCH();
+            HANDLER(OP_SRLI)  regs[inst->rd] = regs[inst->rs1] >> (inst->imm & 0x1F); DISPATCH();
+            HANDLER(OP_SRAI)  regs[inst->rd] = (int32_t)regs[inst->rs1] >> (inst->imm & 0x1F); DISPATCH();
+            HANDLER(OP_ORI)   regs[inst->rd] = regs[inst->rs1] | inst->imm; DISPATCH();
+            HANDLER(OP_ANDI)  regs[inst->rd] = regs[inst->rs1] & inst->imm; DISPATCH();
+
+            HANDLER(OP_AUIPC) regs[inst->rd] = INST_PC(*inst) + inst->imm; DISPATCH();
+
+            HANDLER(OP_SB) WRITE_8(regs[inst->rs1] + inst->imm, regs[inst->rs2] & 0xFF); DISPATCH();
+            HANDLER(OP_SH) WRITE_16(regs[inst->rs1] + inst->imm, regs[inst->rs2] & 0xFFFF); DISPATCH();
+            HANDLER(OP_SW) WRITE_32(regs[inst->rs1] + inst->imm, regs[inst->rs2]); DISPATCH();
+
+            HANDLER(OP_ADD)  regs[inst->rd] = regs[inst->rs1] + regs[inst->rs2]; DISPATCH();
+            HANDLER(OP_SUB)  regs[inst->rd] = regs[inst->rs1] - regs[inst->rs2]; DISPATCH();
+            HANDLER(OP_SLL)  regs[inst->rd] = regs[inst->rs1] << (regs[inst->rs2] & 0x1F); DISPATCH();
+            HANDLER(OP_SLT)  regs[inst->rd] = ((int32_t)regs[inst->rs1] < (int32_t)regs[inst->rs2]) ? 1 : 0; DISPATCH();
+            HANDLER(OP_SLTU) regs[inst->rd] = (regs[inst->rs1] < regs[inst->rs2]) ? 1 : 0; DISPATCH();
+            HANDLER(OP_XOR)  regs[inst->rd] = regs[inst->rs1] ^ regs[inst->rs2]; DISPATCH();
+            HANDLER(OP_SRL)  regs[inst->rd] = regs[inst->rs1] >> (regs[inst->rs2] & 0x1F); DISPATCH();
+            HANDLER(OP_SRA)  regs[inst->rd] = (int32_t)regs[inst->rs1] >> (regs[inst->rs2] & 0x1F); DISPATCH();
+            HANDLER(OP_OR)   regs[inst->rd] = regs[inst->rs1] | regs[inst->rs2]; DISPATCH();
+            HANDLER(OP_AND)  regs[inst->rd] = regs[inst->rs1] & regs[inst->rs2]; DISPATCH();
+
+            HANDLER(OP_MUL)    regs[inst->rd] = regs[inst->rs1] * regs[inst->rs2]; DISPATCH();
+            HANDLER(OP_MULH)   regs[inst->rd] = MULH(regs[inst->rs1], regs[inst->rs2]); DISPATCH();
+            HANDLER(OP_MULHSU) regs[inst->rd] = MULHSU(regs[inst->rs1], regs[inst->rs2]); DISPATCH();
+            HANDLER(OP_MULHU)  regs[inst->rd] = MULHU(regs[inst->rs1], regs[inst->rs2]); DISPATCH();
+            HANDLER(OP_DIV)    regs[inst->rd] = DIV(regs[inst->rs1], regs[inst->rs2]); DISPATCH();
+            HANDLER(OP_DIVU)   regs[inst->rd] = DIVU(regs[inst->rs1], regs[inst->rs2]); DISPATCH();
+            HANDLER(OP_REM)    regs[inst->rd] = REM(regs[inst->rs1], regs[inst->rs2]); DISPATCH();
+            HANDLER(OP_REMU)   regs[inst->rd] = REMU(regs[inst->rs1], regs[inst->rs2]); DISPATCH();
+
+            HANDLER(OP_LUI) regs[inst->rd] = inst->imm; DISPATCH();
+
+            HANDLER(OP_BEQ)  BRANCH<BP>(regs[inst->rs1] == regs[inst->rs2], *inst); DISPATCH();
+            HANDLER(OP_BNE)  BRANCH<BP>(regs[inst->rs1] != regs[inst->rs2], *inst); DISPATCH();
+            HANDLER(OP_BLT)  BRANCH<BP>((int32_t)regs[inst->rs1] < (int32_t)regs[inst->rs2], *inst); DISPATCH();
+            HANDLER(OP_BGE)  BRANCH<BP>((int32_t)regs[inst->rs1] >= (int32_t)regs[inst->rs2], *inst); DISPATCH();
+            HANDLER(OP_BLTU) BRANCH<BP>(regs[inst->rs1] < regs[inst->rs2], *inst); DISPATCH();
+            HANDLER(OP_BGEU) BRANCH<BP>(regs[inst->rs1] >= regs[inst->rs2], *inst); DISPATCH();
+
+            HANDLER(OP_JALR){
+                uint32_t targ = (regs[inst->rs1] + inst->imm) & ~1;
+                regs[inst->rd] = PC;
+                JUMP<BP>(INST_PC(*inst), PC, targ, inst->rd, inst->rs1);
+                DISPATCH();
+            }
+            HANDLER(OP_JAL)
+                regs[inst->rd] = PC;
+                JUMP<BP>(INST_PC(*inst), PC, INST_PC(*inst) + inst->imm, inst->rd, 0);
+                DISPATCH();
+#if !defined(__GNUC__)
+            default: DISPATCH();
+#endif
+            }
+#if !defined(__GNUC__)
+        }
+#endif
+        #undef HANDLER
+        #undef DISPATCH
+    }
 
-            PC += 4;
+    //Translated-block tiers (JIT and micro-op IR). A translated block retires its instructions
+    //without STEP_BEGIN, so Block_Sync catches the counters and flight recorder up before
+    //anything that can observe them (memory access, branch, block exit).
 
-            Decoded_Instruction inst = DECODE(raw);
+    void Block_Enter(uint32_t pc, const uint32_t* raw, uint32_t count){
+        block_pc = pc;
+        block_raw = raw;
+        block_count = count;
+        block_synced = 0;
+        block_exit = false;
+    }
 
+    void Block_Sync(uint32_t index){  //Accounts block instructions up to and including index, like STEP_BEGIN would
+        for(; block_synced <= index; block_synced++){
+            Log_Trace(block_pc, block_raw[block_synced]);
+            if(caches) cycle_count += caches->Fetch(block_pc);
+            block_pc += INST_LENGTH(block_raw[block_synced]);
             cycle_count++;
             inst_count++;
+        }
+    }
+
+    template<int OP> uint32_t Block_Load(uint32_t addr, uint32_t index){
+        Block_Sync(index);
+
+        uint32_t val = 0;
+        switch(OP){
+            case OP_LB:  val = (int8_t)READ_8(addr); break;
+            case OP_LH:  val = (int16_t)READ_16(addr); break;
+            case OP_LW:  val = READ_32(addr); break;
+            case OP_LBU: val = READ_8(addr); break;
+            case OP_LHU: val = READ_16(addr); break;
+        }
 
-            csrs[MCYCLE_L]    = cycle_count & 0xFFFFFFFF;
-            csrs[MCYCLE_H]   = cycle_count >> 32;
-            csrs[MINSTRET_L]  = inst_count & 0xFFFFFFFF;
-            csrs[MINSTRET_H] = inst_count >> 32;
+        if(!running) block_exit = true; //Segfault: stop right after this instruction
+        if(caches && Block_Event_Due(block_count - index - 1)) block_exit = true;  //A miss brought an event into the block
+        return val;
+    }
+
+    template<int OP> void Block_Store(uint32_t addr, uint32_t val, uint32_t index){
+        Block_Sync(index);
+
+        switch(OP){
+            case OP_SB: WRITE_8(addr, val & 0xFF); break;
+            case OP_SH: WRITE_16(addr, val & 0xFFFF); break;
+            case OP_SW: WRITE_32(addr, val); break;
+        }
+
+        //Segfault, or a CLINT write moved the next event and the dispatcher must service it
+        if(!running || cycle_count >= next_event.load(std::memory_order_relaxed)) block_exit = true;
+        if(caches && Block_Event_Due(block_count - index - 1)) block_exit = true;
+    }
+
+    bool Block_Event_Due(uint32_t count){ //Would STEP_BEGIN service an event within the next count instructions?
+        uint64_t cycles = count;
+        if(caches) cycles += caches->Fetch_Bound(count);   //Misses can only make the block longer
+        return cycle_count + cycles > next_event.load(std::memory_order_relaxed);
+    }
 
-            EXECUTE(inst);
+    //Gathers the basic block at pc for translation; SYSTEM instructions stay with the interpreter.
+    //end_pc receives the address just past the block.
+    bool Collect_Block(uint32_t pc, std::vector<Decoded_Instruction>& insts, std::vector<uint32_t>& raw, uint32_t& end_pc){
+        for(end_pc = pc; insts.size() < BLOCK_MAX_LENGTH;){
+            Decoded_Instruction* inst = FETCH_DECODED(end_pc);
+            if(!inst || inst == &uncached_inst || inst->op == OP_GENERIC) break;
+
+            inst->valid |= DECODED_BLOCK;   //Stores to this instruction now have to drop the block
+            insts.push_back(*inst);
+            raw.push_back(inst->raw);
+            end_pc += INST_LENGTH(inst->raw);
+            if(ENDS_BLOCK(inst->op)) break;
+        }
+        return !insts.empty();
+    }
 
-            if(PC - MEM_Offset >= MAX_MEMORY){
+    void Blocks_Invalidate(uint32_t addr, uint32_t size){   //A store hit translated code
+        bool hit = jit_blocks.Invalidate(addr, size);
+        hit |= ir_blocks.Invalidate(addr, size);
+        if(hit) block_exit = true;
+    }
+
+    void Blocks_Flush(){
+        jit_blocks.Flush();
+        ir_blocks.Flush();
+        jit_cache.Reset();
+    }
+
+    template<typename BP> void Interpret_Block(){   //Cold code: interpret up to the end of the basic block
+        Decoded_Instruction* inst;
+        do{
+            inst = STEP_BEGIN();
+            if(!inst) break;
+
+            EXECUTE<BP>(*inst);
+
+            if(PC - dram.base >= dram.size){
                 running = false;
             }
+        } while(running && !ENDS_BLOCK(inst->op));
+    }
+
+    //JIT tier: native blocks call back through these (see jit_x86_64.h)
+    template<int OP> static uint32_t Jit_Load(RISC_V* cpu, uint32_t addr, uint32_t index){
+        return cpu->Block_Load<OP>(addr, index);
+    }
+
+    template<int OP> static void Jit_Store(RISC_V* cpu, uint32_t addr, uint32_t val, uint32_t index){
+        cpu->Block_Store<OP>(addr, val, index);
+    }
+
+    template<typename BP> static void Jit_Branch(RISC_V* cpu, uint32_t taken, uint32_t target, uint32_t index, uint32_t next_pc, uint32_t pc){
+        cpu->Block_Sync(index);
+        cpu->PC = next_pc;
+        cpu->BRANCH<BP>(taken != 0, pc, target);
+    }
+
+    template<typename BP> static void Jit_Jump(RISC_V* cpu, uint32_t target, uint32_t index, uint32_t pc, uint32_t link_regs, uint32_t link){
+        cpu->Block_Sync(index);
+        cpu->JUMP<BP>(pc, link, target, link_regs & 0xFF, link_regs >> 8);
+    }
+
+    bool Jit_Init(){
+        if(!jit_cache.Init()) return false;
+
+        jit_layout.regs = (int32_t)(reinterpret_cast<uint8_t*>(regs) - reinterpret_cast<uint8_t*>(this));
+        jit_layout.pc = (int32_t)(reinterpret_cast<uint8_t*>(&PC) - reinterpret_cast<uint8_t*>(this));
+        jit_layout.exit = (int32_t)(reinterpret_cast<uint8_t*>(&block_exit) - reinterpret_cast<uint8_t*>(this));
+        jit_layout.load[0] = reinterpret_cast<const void*>(&Jit_Load<OP_LB>);
+        jit_layout.load[1] = reinterpret_cast<const void*>(&Jit_Load<OP_LH>);
+        jit_layout.load[2] = reinterpret_cast<const void*>(&Jit_Load<OP_LW>);
+        jit_layout.load[3] = reinterpret_cast<const void*>(&Jit_Load<OP_LBU>);
+        jit_layout.load[4] = reinterpret_cast<const void*>(&Jit_Load<OP_LHU>);
+        jit_layout.store[0] = reinterpret_cast<const void*>(&Jit_Store<OP_SB>);
+        jit_layout.store[1] = reinterpret_cast<const void*>(&Jit_Store<OP_SH>);
+        jit_layout.store[2] = reinterpret_cast<const void*>(&Jit_Store<OP_SW>);
+        return true;
+    }
+
+    Jit_Block* Jit_Compile(uint32_t pc){    //Translates the block at pc, nullptr if it can't be translated
+        std::vector<Decoded_Instruction> insts;
+        std::vector<uint32_t> raw;
+        uint32_t end_pc;
+        if(!Collect_Block(pc, insts, raw, end_pc)) return nullptr;
+
+        std::vector<uint8_t> code = Jit_Translate(insts, pc, jit_layout);
+        uint8_t* host = jit_cache.Install(code);
+        if(!host){  //Code cache full: start over
+            Blocks_Flush();
+            host = jit_cache.Install(code);
+            if(!host) return nullptr;
+        }
+
+        Jit_Block* block = new Jit_Block();
+        block->start_pc = pc;
+        block->end_pc = end_pc;
+        block->count = (uint32_t)insts.size();
+        block->code = reinterpret_cast<Jit_Entry>(host);
+        block->raw = raw;
+        block->ends_in_jump = insts.back().op == OP_JAL || insts.back().op == OP_JALR;
+        jit_blocks.Insert(block);
+        return block;
+    }
+
+    template<typename BP> void RUN_JIT(){   //Interprets cold blocks, runs hot ones as native code
+        jit_layout.branch = reinterpret_cast<const void*>(&Jit_Branch<BP>);
+        jit_layout.jump = (BP::ENABLED || profiler) ? reinterpret_cast<const void*>(&Jit_Jump<BP>) : nullptr;
+
+        while(running){
+            Jit_Block* block = jit_blocks.Lookup(PC);
+
+            //A block only runs natively if no interrupt can be due before it ends, so
+            //interrupts are taken on exactly the same instruction as in the interpreter
+            if(block && !Block_Event_Due(block->count)){
+                Block_Enter(block->start_pc, block->raw.data(), block->count);
+                uint32_t retired = block->code(this);
+                Block_Sync(retired - 1);
+                if(!jit_layout.jump && retired == block->count && block->ends_in_jump){
+                    hpm_events[HPM_JUMPS]++;    //JAL/JALR ran inline, without calling JUMP
+                }
+                jit_blocks.Reclaim();
+
+                if(PC - dram.base >= dram.size){
+                    running = false;
+                }
+                continue;
+            }
+
+            if(!block && (PC & 1) == 0 && jit_blocks.Hot(PC)){
+                if(Jit_Compile(PC)) continue;
+                jit_blocks.Cool(PC);    //Not translatable (starts with a SYSTEM instruction), retry much later
+            }
+
+            Interpret_Block<BP>();
+        }
+    }
+
+    //Micro-op IR tier: same block discovery as the JIT, but blocks are lifted into Uops
+    //(see block_ir.h) and run by the portable interpreter below.
+
+    Ir_Block* Ir_Compile(uint32_t pc){
+        std::vector<Decoded_Instruction> insts;
+        Ir_Block* block = new Ir_Block();
+        if(!Collect_Block(pc, insts, block->raw, block->end_pc)){
+            delete block;
+            return nullptr;
         }
+
+        block->start_pc = pc;
+        block->count = (uint32_t)insts.size();
+        block->uops = Ir_Lift(insts, pc);
+        Ir_Optimize(block->uops);
+        ir_blocks.Insert(block);
+        return block;
     }
+
+    //Runs one IR block. Returns the successor link to follow (0 taken/jump, 1 fall-through),
+    //or -1 if the block stopped early.
+    template<typename BP> int Ir_Execute(const Ir_Block* block){
+        Block_Enter(block->start_pc, block->raw.data(), block->count);
+
+        for(const Uop* u = block->uops.data();; u++){
+            switch(u->kind){
+                case U_LI:   regs[u->rd] = u->imm; break;
+                case U_ADD:  regs[u->rd] = regs[u->rs1] + regs[u->rs2]; break;
+                case U_SUB:  regs[u->rd] = regs[u->rs1] - regs[u->rs2]; break;
+                case U_SLL:  regs[u->rd] = regs[u->rs1] << (regs[u->rs2] & 0x1F); break;
+                case U_SLT:  regs[u->rd] = ((int32_t)regs[u->rs1] < (int32_t)regs[u->rs2]) ? 1 : 0; break;
+                case U_SLTU: regs[u->rd] = (regs[u->rs1] < regs[u->rs2]) ? 1 : 0; break;
+                case U_XOR:  regs[u->rd] = regs[u->rs1] ^ regs[u->rs2]; break;
+                case U_SRL:  regs[u->rd] = regs[u->rs1] >> (regs[u->rs2] & 0x1F); break;
+                case U_SRA:  regs[u->rd] = (int32_t)regs[u->rs1] >> (regs[u->rs2] & 0x1F); break;
+                case U_OR:   regs[u->rd] = regs[u->rs1] | regs[u->rs2]; break;
+                case U_AND:  regs[u->rd] = regs[u->rs1] & regs[u->rs2]; break;
+                case U_MUL:    regs[u->rd] = regs[u->rs1] * regs[u->rs2]; break;
+                case U_MULH:   regs[u->rd] = MULH(regs[u->rs1], regs[u->rs2]); break;
+                case U_MULHSU: regs[u->rd] = MULHSU(regs[u->rs1], regs[u->rs2]); break;
+                case U_MULHU:  regs[u->rd] = MULHU(regs[u->rs1], regs[u->rs2]); break;
+                case U_DIV:    regs[u->rd] = DIV(regs[u->rs1], regs[u->rs2]); break;
+                case U_DIVU:   regs[u->rd] = DIVU(regs[u->rs1], regs[u->rs2]); break;
+                case U_REM:    regs[u->rd] = REM(regs[u->rs1], regs[u->rs2]); break;
+                case U_REMU:   regs[u->rd] = REMU(regs[u->rs1], regs[u->rs2]); break;
+                case U_ADDI:  regs[u->rd] = regs[u->rs1] + u->imm; break;
+                case U_SLTI:  regs[u->rd] = ((int32_t)regs[u->rs1] < (int32_t)u->imm) ? 1 : 0; break;
+                case U_SLTIU: regs[u->rd] = (regs[u->rs1] < u->imm) ? 1 : 0; break;
+                case U_XORI:  regs[u->rd] = regs[u->rs1] ^ u->imm; break;
+                case U_ORI:   regs[u->rd] = regs[u->rs1] | u->imm; break;
+                case U_ANDI:  regs[u->rd] = regs[u->rs1] & u->imm; break;
+                case U_SLLI:  regs[u->rd] = regs[u->rs1] << u->imm; break;
+                case U_SRLI:  regs[u->rd] = regs[u->rs1] >> u->imm; break;
+                case U_SRAI:  regs[u->rd] = (int32_t)regs[u->rs1] >> u->imm; break;
+
+                case U_LB:  regs[u->rd] = Block_Load<OP_LB>(regs[u->rs1] + u->imm, u->index); goto loaded;
+                case U_LH:  regs[u->rd] = Block_Load<OP_LH>(regs[u->rs1] + u->imm, u->index); goto loaded;
+                case U_LW:  regs[u->rd] = Block_Load<OP_LW>(regs[u->rs1] + u->imm, u->index); goto loaded;
+                case U_LBU: regs[u->rd] = Block_Load<OP_LBU>(regs[u->rs1] + u->imm, u->index); goto loaded;
+                case U_LHU: regs[u->rd] = Block_Load<OP_LHU>(regs[u->rs1] + u->imm, u->index); goto loaded;
+                case U_SB: Block_Store<OP_SB>(regs[u->rs1] + u->imm, regs[u->rs2], u->index); goto stored;
+                case U_SH: Block_Store<OP_SH>(regs[u->rs1] + u->imm, regs[u->rs2], u->index); goto stored;
+                case U_SW: Block_Store<OP_SW>(regs[u->rs1] + u->imm, regs[u->rs2], u->index); goto stored;
+
+                case U_BEQ:  return Ir_Branch<BP>(u, regs[u->rs1] == regs[u->rs2]);
+                case U_BNE:  return Ir_Branch<BP>(u, regs[u->rs1] != regs[u->rs2]);
+                case U_BLT:  return Ir_Branch<BP>(u, (int32_t)regs[u->rs1] < (int32_t)regs[u->rs2]);
+                case U_BGE:  return Ir_Branch<BP>(u, (int32_t)regs[u->rs1] >= (int32_t)regs[u->rs2]);
+                case U_BLTU: return Ir_Branch<BP>(u, regs[u->rs1] < regs[u->rs2]);
+                case U_BGEU: return Ir_Branch<BP>(u, regs[u->rs1] >= regs[u->rs2]);
+                case U_JAL:
+                    Block_Sync(u->index);
+                    regs[u->rd] = u->aux;
+                    regs[0] = 0;
+                    JUMP<BP>(u->aux - INST_LENGTH(block_raw[u->index]), u->aux, u->imm, u->rd, 0);
+                    return 0;
+                case U_JALR:{
+                    Block_Sync(u->index);
+                    uint32_t targ = (regs[u->rs1] + u->imm) & ~1;
+                    regs[u->rd] = u->aux;
+                    regs[0] = 0;
+                    JUMP<BP>(u->aux - INST_LENGTH(block_raw[u->index]), u->aux, targ, u->rd, u->rs1);
+                    return 0;   //Chain link 0 acts as a one-entry target cache
+                }
+                case U_EXIT:
+                    Block_Sync(u->index);
+                    PC = u->imm;
+                    return 1;
+            }
+            continue;
+
+        loaded:
+            regs[0] = 0;
+        stored:
+            if(block_exit){
+                PC = block_pc;  //Just past this instruction, where Block_Sync stopped
+                return -1;
+            }
+        }
+    }
+
+    template<typename BP> int Ir_Branch(const Uop* u, bool take){   //Fused compare-and-branch terminator
+        Block_Sync(u->index);
+        PC = u->aux;
+        BRANCH<BP>(take, u->aux - INST_LENGTH(block_raw[u->index]), u->imm);
+        return take ? 0 : 1;
+    }
+
+    template<typename BP> void Ir_Run_Chain(Ir_Block* block){   //Runs blocks back to back along their successor links
+        for(;;){
+            int link = Ir_Execute<BP>(block);
+            if(link < 0 || !running) break;
+
+            if(PC - dram.base >= dram.size){
+                running = false;
+                break;
+            }
+
+            Ir_Block* next = block->next[link];
+            if(!next || block->next_epoch[link] != ir_blocks.epoch || next->start_pc != PC){  //Epoch first: a stale link may point at a freed block
+                next = ir_blocks.Lookup(PC);
+                if(!next) break;
+                block->next[link] = next;
+                block->next_epoch[link] = ir_blocks.epoch;
+            }
+
+            //Events come from SYSTEM instructions (never inside a block), the clock or CLINT
+            //writes (which zero next_event), so this is the only check needed between chained blocks
+            if(Block_Event_Due(next->count)) break;
+            block = next;
+        }
+        ir_blocks.Reclaim();
+    }
+
+    template<typename BP> void RUN_BLOCK(){ //Portable fast path: interprets cold blocks, runs hot ones as optimized IR
+        while(running){
+            Ir_Block* block = ir_blocks.Lookup(PC);
+
+            if(block && !Block_Event_Due(block->count)){
+                Ir_Run_Chain<BP>(block);
+                continue;
+            }
+
+            if(!block && (PC & 1) == 0 && ir_blocks.Hot(PC)){
+                if(Ir_Compile(PC)) continue;
+                ir_blocks.Cool(PC);
+            }
+
+            Interpret_Block<BP>();
+        }
+    }
+
+    //Snapshots: everything RUN needs to resume the guest. Decode and block caches are rebuilt
+    //on demand and the flight recorder starts empty.
+    void Snapshot_State(Snapshot_Out& out){
+        out.Put(regs);
+        out.Put(PC);
+        out.Put(csrs);
+        out.Put(mtimecmp.load());
+        out.Put(msip.load());
+        out.Put(mtvec);
+        out.Put(mepc);
+        out.Put(mcause);
+        out.Put(mstatus);
+        out.Put(cycle_count);
+        out.Put(inst_count);
+        out.Put(counter_offset);
+        out.Put(counter_frozen);
+        out.Put(hpm_events);
+        out.Put(time_offset);
+        out.Put(machine.uart->ier.load());
+        out.Put((uint32_t)predictor->kind);
+        predictor->Save(out);
+
+        out.Put(dram.base);
+        out.Put(dram.size);
+        out.Put((uint32_t)machine.extra_ram.size());
+        for(const auto& region : machine.extra_ram){
+            out.Put(region.base);
+            out.Put(region.size);
+        }
+
+        out.Put((uint32_t)machine.memory_map.size());
+        for(const auto& seg : machine.memory_map) out.Put(seg);
+    }
+
+    bool SAVE_SNAPSHOT(const std::string& path){ //Full snapshot, or incremental on top of snapshot_parent
+        Snapshot_Out out;
+        if(!out.Open(path)){
+            *machine.errors << "Error: Cannot write snapshot \"" << path << "\"" << std::endl;
+            return false;
+        }
+
+        out.Put_String(snapshot_parent);
+        Snapshot_State(out);
+
+        bool incremental = !snapshot_parent.empty();
+        std::vector<Ram_Region*> regions = {&dram};
+        for(auto& region : machine.extra_ram) regions.push_back(&region);
+
+        std::vector<uint8_t> packed;
+        static const uint8_t zero_page[PAGE_SIZE] = {};
+        for(Ram_Region* region : regions){
+            for(uint32_t page = 0; page < region->size >> PAGE_SHIFT; page++){
+                const uint8_t* data = region->host + ((size_t)page << PAGE_SHIFT);
+                bool store = incremental ? region->dirty[page] != 0 : std::memcmp(data, zero_page, PAGE_SIZE) != 0;
+                region->dirty[page] = 0;
+                if(!store) continue;
+
+                Pack_Page(data, PAGE_SIZE, packed);
+                uint16_t length = (uint16_t)packed.size();
+                if(packed.size() >= PAGE_SIZE) length = PAGE_RAW_FLAG;
+
+                out.Put(region->base + (page << PAGE_SHIFT));
+                out.Put(length);
+                if(length == PAGE_RAW_FLAG) out.Put(data, PAGE_SIZE);
+                else out.Put(packed.data(), packed.size());
+            }
+        }
+        out.Put(SNAPSHOT_END);
+
+        if(!out.Ok()){
+            *machine.errors << "Error: Cannot write snapshot \"" << path << "\"" << std::endl;
+            return false;
+        }
+
+        std::cout << "[Emulator] Snapshot " << path << " saved at instruction " << inst_count << std::endl;
+        snapshot_parent = path;
+        return true;
+    }
+
+    bool Restore_Predictor(Snapshot_In& in){    //The snapshot's predictor replaces the --bpred one
+        uint32_t kind;
+        if(!in.Get(kind) || kind > BP_TAGE) return false;
+        if(kind != (uint32_t)predictor->kind) predictor.reset(Make_Predictor((Predictor_Kind)kind));
+        return predictor->Load(in);
+    }
+
+    bool RESTORE_SNAPSHOT(const std::string& path, int depth = 0){ //Replays the parent chain, then this snapshot
+        Snapshot_In in;
+        std::string parent;
+        if(!in.Open(path) || !in.Get_String(parent)){
+            *machine.errors << "Error: \"" << path << "\" is not a snapshot" << std::endl;
+            return false;
+        }
+        if(!parent.empty() && (depth >= 256 || !RESTORE_SNAPSHOT(parent, depth + 1))) return false;
+
+        uint32_t extra_count, segment_count, uart_ier, clint_msip;
+        uint64_t clint_mtimecmp;
+        Ram_Region layout;
+        bool ok = in.Get(regs) && in.Get(PC) && in.Get(csrs) && in.Get(clint_mtimecmp) && in.Get(clint_msip) && in.Get(mtvec)
+            && in.Get(mepc) && in.Get(mcause) && in.Get(mstatus) && in.Get(cycle_count) && in.Get(inst_count)
+            && in.Get(counter_offset) && in.Get(counter_frozen) && in.Get(hpm_events) && in.Get(time_offset) && in.Get(uart_ier)
+            && Restore_Predictor(in) && in.Get(layout.base) && in.Get(layout.size) && in.Get(extra_count) && extra_count <= 64;
+
+        std::vector<Ram_Region> extra(ok ? extra_count : 0);
+        for(auto& region : extra) ok = ok && in.Get(region.base) && in.Get(region.size);
+        ok = ok && in.Get(segment_count) && segment_count <= 4096;
+        if(!ok){
+            *machine.errors << "Error: Snapshot \"" << path << "\" is truncated" << std::endl;
+            return false;
+        }
+        machine.uart->ier.store(uart_ier & 1);
+        mtimecmp.store(clint_mtimecmp);
+        msip.store(clint_msip & 1);
+        mtip_clear.store(false);
+
+        machine.memory_map.resize(segment_count);
+        for(auto& seg : machine.memory_map) ok = ok && in.Get(seg);
+
+        if(parent.empty()){ //The full snapshot at the root of the chain lays out RAM
+            dram.Release();
+            for(auto& region : machine.extra_ram) region.Release();
+            dram.base = layout.base;
+            dram.size = layout.size;
+            machine.dram_auto_base = false;
+            machine.extra_ram = extra;
+            if(!machine.Allocate_Ram()) return false;
+        }
+        else{
+            bool same = layout.base == dram.base && layout.size == dram.size && extra.size() == machine.extra_ram.size();
+            for(size_t i = 0; same && i < extra.size(); i++){
+                same = extra[i].base == machine.extra_ram[i].base && extra[i].size == machine.extra_ram[i].size;
+            }
+            if(!same){
+                *machine.errors << "Error: Snapshot \"" << path << "\" does not match the RAM layout of its parent" << std::endl;
+                return false;
+            }
+        }
+
+        std::vector<uint8_t> packed(PAGE_SIZE);
+        for(;;){
+            uint32_t addr;
+            uint16_t length;
+            if(!ok || !in.Get(addr)) break;
+            if(addr == SNAPSHOT_END) return true;
+
+            uint8_t* host = machine.Host_Address(addr, PAGE_SIZE);
+            if(!in.Get(length) || !host || (addr & (PAGE_SIZE - 1))) break;
+
+            if(length == PAGE_RAW_FLAG) ok = in.Get(host, PAGE_SIZE);
+            else ok = length < PAGE_SIZE && in.Get(packed.data(), length) && Unpack_Page(packed.data(), length, host, PAGE_SIZE);
+        }
+
+        *machine.errors << "Error: Snapshot \"" << path << "\" is corrupt" << std::endl;
+        return false;
+    }
+
+    bool BOOT(std::string FileName){    //Loads the program (or restores a snapshot) and starts this hart
+        if(!restore_path.empty()){
+            if(!RESTORE_SNAPSHOT(restore_path)){
+                *machine.errors<<"\nError: Cannot restore snapshot \""<<restore_path<<"\"\n";
+                return false;
+            }
+            machine.Build_Page_Table();
+            snapshot_parent = restore_path;
+            decode_cache.assign(dram.size >> PAGE_SHIFT, nullptr);
+            running = true;
+            return true;
+        }
+
+        if(!machine.LOAD_FILE(FileName)) {
+            *machine.errors<<"\nError: Cannot open file \""<<FileName<<"\"\n";
+            return false;
+        }
+        Reset();
+        return true;
+    }
+
+    template<typename BP> void RUN_CORE(){
+        if(core == CORE_JIT) RUN_JIT<BP>();
+        else if(core == CORE_BLOCK) RUN_BLOCK<BP>();
+        else if(core == CORE_THREADED) RUN_THREADED<BP>();
+        else RUN_SWITCH<BP>();
+    }
+
+    void RUN_HART(){ // Runs the program loop and Instruction Cycle, on its own thread for every hart but 0
+        if(core == CORE_JIT && !Jit_Init()){
+            *machine.errors << "Warning: JIT not available on this host, using the switch core" << std::endl;
+            core = CORE_SWITCH;
+        }
+
+        pause_at = std::min(snapshot_at, inst_limit);
+        next_event = 0;
+        for(;;){
+            Predictor_Kind kind = predictor->kind;
+            if(kind == BP_BIMODAL) RUN_CORE<Bimodal_Unit>();
+            else if(kind == BP_GSHARE) RUN_CORE<Gshare_Unit>();
+            else if(kind == BP_TAGE) RUN_CORE<Tage_Unit>();
+            else RUN_CORE<No_Predictor>();
+
+            if(!paused) break;
+            paused = false;
+
+            if(inst_count >= inst_limit){
+                machine.limited = true;
+                break;
+            }
+
+            std::string path = snapshot_path;
+            if(snapshots_taken > 0) path += "." + std::to_string(snapshots_taken);
+            if(SAVE_SNAPSHOT(path)) snapshots_taken++;
+
+            snapshot_at = snapshot_every ? snapshot_at + snapshot_every : UINT64_MAX;
+            pause_at = std::min(snapshot_at, inst_limit);
+            next_event = 0;
+            running = true;
+        }
+
+        if(trace_stream) trace_stream->Append(trace_buffer, trace_index);  //What is left since the last full ring
+        machine.Halt(); //Exit, fault or running off the end of memory stops the whole machine
+    }
+};
+
+
+struct Run_Config{  //Options of one run, from the command line or a batch manifest line
+    std::string filename;
+    Core_Kind core = JIT_SUPPORTED ? CORE_JIT : CORE_SWITCH;
+    bool no_jit = false;
+    Predictor_Kind bpred = BP_BIMODAL;
+    Cache_Setup caches;
+    uint32_t harts = 1;
+    uint64_t inst_limit = UINT64_MAX;
+    int ram_options = 0;
+    Ram_Region dram;    //Size (and base) of main memory if --ram gave one
+    bool dram_has_base = false;
+    std::vector<Ram_Region> extra_ram;
+    std::string snapshot_path;
+    uint64_t snapshot_at = UINT64_MAX;
+    uint64_t snapshot_every = 0;
+    std::string restore_path;
+    std::string trace_path; //Hart 0 writes this file, hart N writes trace_path.N
+    bool trace_compress = false;
+    std::string profile_path;   //Folded stacks of every hart go here
+    uint64_t profile_interval = 10000;  //Instructions between samples
+    bool profile_stacks = false;
+    std::string uart_in;    //UART input from this file instead of stdin
+    uint64_t realtime_hz = 0;   //--realtime: WFI sleeps the host at this clock rate, 0 = virtual time
 };
 
+struct Run_Result{
+    bool loaded = false;
+    bool exited = false;
+    bool faulted = false;
+    bool limited = false;
+    uint32_t exit_code = 0;
+    Core_Kind core = CORE_SWITCH;   //What hart 0 ended up running on
+    uint64_t inst_count = 0;    //All harts together
+    uint64_t cycle_count = 0;   //Slowest hart, they run in parallel
+    uint64_t jit_compiled = 0;
+    uint64_t ir_compiled = 0;
+    Predictor_Kind bpred = BP_NONE;
+    Branch_Stats branch;    //All harts together
+    uint64_t cache_hits[CACHE_LEVELS] = {};
+    uint64_t cache_misses[CACHE_LEVELS] = {};
+    Profile profile;    //--profile samples of all harts
+};
+
+//Applies one argument to config; false (with error set) if it is malformed or not a run option
+bool Parse_Run_Option(const std::string& arg, Run_Config& config, std::string& error){
+    if(arg == "--core=switch") config.core = CORE_SWITCH;
+    else if(arg == "--core=threaded") config.core = CORE_THREADED;
+    else if(arg == "--core=jit") config.core = CORE_JIT;
+    else if(arg == "--core=block") config.core = CORE_BLOCK;
+    else if(arg == "--no-jit") config.no_jit = true;
+    else if(arg.rfind("--bpred=", 0) == 0){
+        std::string name = arg.substr(8);
+        int kind = BP_NONE;
+        while(kind <= BP_TAGE && name != PREDICTOR_NAMES[kind]) kind++;
+        if(kind > BP_TAGE){
+            error = "--bpred takes none, bimodal, gshare or tage";
+            return false;
+        }
+        config.bpred = (Predictor_Kind)kind;
+    }
+    else if(arg == "--cache" || arg.rfind("--cache=", 0) == 0){
+        if(!Parse_Cache_Option(arg.size() > 7 ? arg.substr(8) : "", config.caches)){
+            error = "Bad cache option " + arg + " (expected LEVEL:SIZE:WAYS:LINE:LATENCY[:lru|fifo|random], LEVEL:off or mem:LATENCY)";
+            return false;
+        }
+    }
+    else if(arg.rfind("--harts=", 0) == 0){
+        config.harts = (uint32_t)std::strtoul(arg.c_str() + 8, nullptr, 0);
+        if(config.harts < 1 || config.harts > 32){
+            error = "--harts takes 1 to 32";
+            return false;
+        }
+    }
+    else if(arg.rfind("--limit=", 0) == 0) config.inst_limit = std::strtoull(arg.c_str() + 8, nullptr, 0);
+    else if(arg.rfind("--snapshot=", 0) == 0) config.snapshot_path = arg.substr(11);
+    else if(arg.rfind("--snapshot-at=", 0) == 0) config.snapshot_at = std::strtoull(arg.c_str() + 14, nullptr, 0);
+    else if(arg.rfind("--snapshot-every=", 0) == 0) config.snapshot_every = std::strtoull(arg.c_str() + 17, nullptr, 0);
+    else if(arg.rfind("--restore=", 0) == 0) config.restore_path = arg.substr(10);
+    else if(arg.rfind("--trace=", 0) == 0) config.trace_path = arg.substr(8);
+    else if(arg == "--trace-compress") config.trace_compress = true;
+    else if(arg.rfind("--profile=", 0) == 0) config.profile_path = arg.substr(10);
+    else if(arg.rfind("--profile-interval=", 0) == 0) config.profile_interval = std::strtoull(arg.c_str() + 19, nullptr, 0);
+    else if(arg == "--profile-stacks") config.profile_stacks = true;
+    else if(arg.rfind("--uart-in=", 0) == 0) config.uart_in = arg.substr(10);
+    else if(arg == "--realtime") config.realtime_hz = 10000000;  //10 MHz, a common CLINT timebase
+    else if(arg.rfind("--realtime=", 0) == 0){
+        config.realtime_hz = std::strtoull(arg.c_str() + 11, nullptr, 0);
+        if(config.realtime_hz == 0){
+            error = "--realtime takes a clock rate in Hz of at least 1";
+            return false;
+        }
+    }
+    else if(arg.rfind("--ram=", 0) == 0){   //First --ram sizes main memory, later ones add regions
+        Ram_Region region;
+        bool has_base;
+        if(!Parse_Ram_Option(arg.substr(6), region, has_base) || (config.ram_options > 0 && !has_base)
+            || (config.ram_options == 0 && region.size < 0x10000)){
+            error = "Bad RAM region " + arg + " (expected SIZE[@BASE], 4 KiB aligned)";
+            return false;
+        }
+        if(config.ram_options++ == 0){
+            config.dram = region;
+            config.dram_has_base = has_base;
+        }
+        else config.extra_ram.push_back(region);
+    }
+    else if(arg.rfind("--", 0) == 0){
+        error = "Unknown option " + arg;
+        return false;
+    }
+    else config.filename = arg;
+    return true;
+}
+
+bool Check_Run_Config(const Run_Config& config, std::string& error){
+    if(config.snapshot_path.empty() != (config.snapshot_at == UINT64_MAX)){
+        error = "--snapshot and --snapshot-at go together";
+        return false;
+    }
+    if(config.harts > 1 && (!config.snapshot_path.empty() || !config.restore_path.empty())){
+        error = "Snapshots need a single hart";
+        return false;
+    }
+    if(config.profile_interval == 0){
+        error = "--profile-interval must be at least 1";
+        return false;
+    }
+    return true;
+}
+
+//Builds a machine for config and runs it until every hart has stopped. Guest output goes to
+//console, load errors and faults to errors.
+Run_Result EMULATE(const Run_Config& config, std::ostream& console, std::ostream& errors, bool keyboard){
+    Machine machine;
+    machine.uart->output.out = &console;
+    if(keyboard) machine.uart->output.Start(config.harts);  //Interactive runs print behind an I/O thread
+    machine.errors = &errors;
+    if(config.ram_options > 0){
+        machine.dram.size = config.dram.size;
+        if(config.dram_has_base){
+            machine.dram.base = config.dram.base;
+            machine.dram_auto_base = false;
+        }
+    }
+    machine.extra_ram = config.extra_ram;
+    machine.stack_window = HART_STACK_SIZE * config.harts;
+
+    std::vector<std::unique_ptr<RISC_V>> harts;    //Hart 0 runs on this thread, the others get one each
+    for(uint32_t id = 0; id < config.harts; id++){
+        harts.emplace_back(new RISC_V(machine, id));
+        RISC_V& hart = *harts.back();
+        hart.core = (config.no_jit && config.core == CORE_JIT) ? CORE_SWITCH : config.core;
+        hart.inst_limit = config.inst_limit;
+        hart.realtime_hz = config.realtime_hz;
+        if(config.bpred != BP_BIMODAL) hart.predictor.reset(Make_Predictor(config.bpred));
+        if(config.caches.enabled) hart.caches.reset(new Cache_Hierarchy(config.caches));
+        if(!config.profile_path.empty()) hart.profiler.reset(new Profiler(config.profile_interval, config.profile_stacks));
+    }
+    harts[0]->snapshot_path = config.snapshot_path;
+    harts[0]->snapshot_at = config.snapshot_at;
+    harts[0]->snapshot_every = config.snapshot_every;
+    harts[0]->restore_path = config.restore_path;
+
+    Run_Result result;
+    for(auto& hart : harts){
+        if(config.trace_path.empty()) break;
+        std::string path = config.trace_path;
+        if(hart->hart_id > 0) path += "." + std::to_string(hart->hart_id);
+        hart->trace_stream.reset(new Trace_Stream());
+        if(!hart->trace_stream->Open(path, hart->hart_id, config.trace_compress)){
+            errors << "Error: Cannot create trace file \"" << path << "\"" << std::endl;
+            return result;
+        }
+    }
+
+    //Interactive runs read stdin, whatever it is; any run can read --uart-in
+    if((keyboard || !config.uart_in.empty()) && !machine.uart->input.Start(config.uart_in)){
+        errors << "Error: Cannot open UART input \"" << config.uart_in << "\"" << std::endl;
+        return result;
+    }
+
+    result.loaded = harts[0]->BOOT(config.filename);
+    if(result.loaded){
+        std::vector<std::thread> threads;
+        for(size_t id = 1; id < harts.size(); id++){
+            harts[id]->Reset();
+            threads.emplace_back(&RISC_V::RUN_HART, harts[id].get());
+        }
+        harts[0]->RUN_HART();
+        for(auto& thread : threads) thread.join();
+    }
+    machine.uart->input.Stop(); //Puts the terminal back
+    machine.uart->output.Stop();    //The guest's last words come before the caller's report
+
+    result.exited = machine.exited;
+    result.faulted = machine.faulted;
+    result.limited = machine.limited;
+    result.exit_code = machine.exit_code;
+    result.core = harts[0]->core;
+    result.bpred = harts[0]->predictor->kind;
+    for(auto& hart : harts){
+        if(hart->trace_stream && !hart->trace_stream->Close()){
+            errors << "Error: Writing the trace of hart " << hart->hart_id << " failed" << std::endl;
+        }
+        result.inst_count += hart->inst_count;
+        result.cycle_count = std::max(result.cycle_count, hart->cycle_count);
+        result.jit_compiled += hart->jit_blocks.compiled;
+        result.ir_compiled += hart->ir_blocks.compiled;
+        result.branch.Add(hart->predictor->stats);
+        for(int i = 0; hart->caches && i < CACHE_LEVELS; i++){
+            result.cache_hits[i] += hart->caches->levels[i].hits;
+            result.cache_misses[i] += hart->caches->levels[i].misses;
+        }
+        if(hart->profiler){
+            result.profile.Add(*hart->profiler, machine.symbols, harts.size() > 1 ? "hart" + std::to_string(hart->hart_id) : "");
+        }
+    }
+    if(!config.profile_path.empty() && !result.profile.Write_Folded(config.profile_path)){
+        errors << "Error: Cannot write profile \"" << config.profile_path << "\"" << std::endl;
+    }
+    return result;
+}
+
+//Batch mode: runs every manifest job on a work-stealing pool, one machine per job
+int RUN_BATCH(const std::string& manifest, const std::string& results_path, unsigned workers){
+    std::vector<Batch_Job> jobs;
+    if(!Read_Manifest(manifest, jobs)){
+        std::cerr << "Error: Cannot read manifest \"" << manifest << "\"" << std::endl;
+        return 1;
+    }
+
+    std::cout << "[Emulator] Running " << jobs.size() << " jobs on " << workers << " threads" << std::endl;
+
+    Thread_Pool pool(workers);
+    pool.Run(jobs.size(), [&](size_t index){
+        Batch_Job& job = jobs[index];
+        Run_Config config;
+        std::string error;
+
+        bool ok = true;
+        for(const auto& arg : job.args) ok = ok && Parse_Run_Option(arg, config, error);
+        ok = ok && Check_Run_Config(config, error);
+        if(ok && (!config.snapshot_path.empty() || !config.restore_path.empty())){
+            error = "Snapshots are not available in batch mode";
+            ok = false;
+        }
+        if(!ok){
+            job.status = "error";
+            job.output = "Error: " + error + "\n";
+            return;
+        }
+
+        std::ostringstream console;
+        auto start = std::chrono::steady_clock::now();
+        Run_Result result = EMULATE(config, console, console, false);
+        job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if(!result.loaded) job.status = "error";
+        else if(result.exited) job.status = "exited";
+        else if(result.faulted) job.status = "fault";
+        else if(result.limited) job.status = "limit";
+        else job.status = "halted";   //Ran off the end of memory
+        job.exit_code = result.exit_code;
+        job.inst_count = result.inst_count;
+        job.cycle_count = result.cycle_count;
+        job.output = console.str();
+    });
+
+    size_t passed = 0;
+    for(const auto& job : jobs) passed += job.status == "exited" && job.exit_code == 0;
+
+    if(!Write_Results(results_path, jobs)){
+        std::cerr << "Error: Cannot write results \"" << results_path << "\"" << std::endl;
+        return 1;
+    }
+    std::cout << "[Emulator] " << passed << " of " << jobs.size() << " jobs exited with code 0, results in " << results_path << std::endl;
+    return passed == jobs.size() ? 0 : 1;
+}
+
 
 int main(int argc, char* argv[]) {
-    if(argc < 2){
-        std::cout << "Usage: ./emulator <elf_file>" << std::endl;
+    Run_Config config;
+    bool show_stats = false;
+    std::string batch_path, results_path = "results.json";
+    unsigned workers = std::thread::hardware_concurrency();
+
+    for(int i = 1; i < argc; i++){  //Parsing command line options
+        std::string arg = argv[i];
+        std::string error;
+
+        if(arg == "--stats") show_stats = true;
+        else if(arg.rfind("--batch=", 0) == 0) batch_path = arg.substr(8);
+        else if(arg.rfind("--results=", 0) == 0) results_path = arg.substr(10);
+        else if(arg.rfind("--jobs=", 0) == 0) workers = (unsigned)std::strtoul(arg.c_str() + 7, nullptr, 0);
+        else if(!Parse_Run_Option(arg, config, error)){
+            std::cerr << "Error: " << error << std::endl;
+            return 1;
+        }
+    }
+
+    if(!batch_path.empty()) return RUN_BATCH(batch_path, results_path, workers ? workers : 1);
+
+    if(config.filename.empty() && config.restore_path.empty()){
+        std::cout << "Usage: ./emulator [--core=switch|threaded|jit|block] [--no-jit] [--bpred=none|bimodal|gshare|tage] [--cache[=...]]... [--stats] [--harts=N] [--limit=N] [--ram=SIZE[@BASE]]..." << std::endl
+                  << "                  [--trace=FILE [--trace-compress]] [--profile=FILE [--profile-interval=N] [--profile-stacks]] [--uart-in=FILE] [--realtime[=HZ]]" << std::endl
+                  << "                  [--snapshot=FILE --snapshot-at=N [--snapshot-every=M]] (<elf_file> | --restore=FILE)" << std::endl
+                  << "       ./emulator --batch=MANIFEST [--results=FILE] [--jobs=N]" << std::endl;
         return 1;
     }
 
-    RISC_V CPU;
-    std::string filename = argv[1];
+    std::string error;
+    if(!Check_Run_Config(config, error)){
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
 
     std::cout << "Starting Emulator..." << std::endl;
-    CPU.RUN(filename);
-    
+
+    auto start = std::chrono::steady_clock::now();
+    Run_Result result = EMULATE(config, std::cout, std::cerr, true);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if(result.exited) std::cout<<"\n[Emulator] Program exited with code "<<result.exit_code<<std::endl;
+    if(result.limited) std::cout<<"\n[Emulator] Stopped after "<<config.inst_limit<<" instructions"<<std::endl;
+
+    if(!config.profile_path.empty()){   //Flat report; the folded stacks are in the file
+        const Profile& p = result.profile;
+        std::cout << "[Emulator] Profile: " << p.samples << " samples every " << config.profile_interval
+                  << " instructions, folded stacks in " << config.profile_path << std::endl;
+        std::printf("[Emulator] %7s %7s %10s  %s\n", "self%", "total%", "samples", "function");
+        for(const auto& f : p.Top(20)){
+            std::printf("[Emulator] %7.2f %7.2f %10llu  %s\n", 100.0 * f.self / p.samples, 100.0 * f.total / p.samples,
+                        (unsigned long long)f.self, f.name.c_str());
+        }
+        std::fflush(stdout);
+    }
+
+    if(show_stats){ //Host-side throughput, used to compare cores
+        std::cout << "[Emulator] " << result.inst_count << " instructions, " << result.cycle_count << " cycles in "
+                  << seconds << " s (" << (seconds > 0 ? result.inst_count / seconds / 1e6 : 0) << " MIPS)" << std::endl;
+        if(result.core == CORE_JIT) std::cout << "[Emulator] JIT translated " << result.jit_compiled << " blocks" << std::endl;
+        if(result.core == CORE_BLOCK) std::cout << "[Emulator] IR lifted " << result.ir_compiled << " blocks" << std::endl;
+        if(result.bpred != BP_NONE){
+            const Branch_Stats& b = result.branch;
+            auto percent = [](uint64_t hits, uint64_t total){ return total ? 100.0 * hits / total : 100.0; };
+            std::cout << "[Emulator] Branch predictor " << PREDICTOR_NAMES[result.bpred] << ": "
+                      << b.branches << " branches (" << percent(b.branches - b.direction_misses, b.branches) << "% direction), "
+                      << b.jumps << " jumps, " << b.returns << " returns (" << percent(b.returns - b.return_misses, b.returns) << "% RAS), "
+                      << b.target_misses << " BTB misses, " << b.mispredicts << " mispredicts (" << b.mispredicts * BRANCH_PENALTY << " cycles)" << std::endl;
+        }
+        for(int i = 0; config.caches.enabled && i < CACHE_LEVELS; i++){
+            const Cache_Config& c = config.caches.levels[i];
+            if(!c.size) continue;
+            uint64_t accesses = result.cache_hits[i] + result.cache_misses[i];
+            std::cout << "[Emulator] " << CACHE_LEVEL_NAMES[i] << " " << (c.size >> 10) << " KiB " << c.ways << "-way " << c.line << " B "
+                      << REPLACEMENT_NAMES[c.policy] << ": " << accesses << " accesses, "
+                      << (accesses ? 100.0 * result.cache_hits[i] / accesses : 100.0) << "% hits" << std::endl;
+        }
+    }
+
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,87 @@
+#pragma once
+//Read-only view of a whole file. On POSIX hosts the file is mmap'd once, so headers can be
+//parsed in place and file pages can be mapped copy-on-write straight into guest RAM; other
+//hosts read it into a buffer and fall back to copying.
+#include<cstdint>
+#include<cstddef>
+#include<string>
+#include<vector>
+#include<fstream>
+#include<iterator>
+
+#ifndef _WIN32
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#endif
+
+struct Mapped_File{
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+#ifndef _WIN32
+    int fd = -1;
+#else
+    std::vector<uint8_t> buffer;
+#endif
+
+    ~Mapped_File(){ Close(); }
+
+    bool Open(const std::string& name){
+        Close();
+#ifndef _WIN32
+        fd = open(name.c_str(), O_RDONLY);
+        if(fd < 0) return false;
+
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size <= 0){
+            Close();
+            return false;
+        }
+        void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(p == MAP_FAILED){
+            Close();
+            return false;
+        }
+        data = static_cast<const uint8_t*>(p);
+        size = (size_t)st.st_size;
+#else
+        std::ifstream file(name, std::ios::binary);
+        if(!file.is_open()) return false;
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        data = buffer.data();
+        size = buffer.size();
+#endif
+        return true;
+    }
+
+    bool Contains(uint64_t offset, uint64_t length) const{ return offset + length <= size; }
+
+    //Maps length bytes of the file at offset copy-on-write over target; both must be page aligned.
+    //Returns false where that isn't possible, the caller copies instead.
+    bool Map_Private(void* target, uint32_t offset, uint32_t length){
+#ifndef _WIN32
+        void* p = mmap(target, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset);
+        if(p == target) return true;
+
+        //A failed MAP_FIXED may already have dropped the old pages: put zeroed ones back
+        mmap(target, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        return false;
+#else
+        (void)target; (void)offset; (void)length;
+        return false;
+#endif
+    }
+
+    void Close(){
+#ifndef _WIN32
+        if(data) munmap(const_cast<uint8_t*>(data), size);
+        if(fd >= 0) close(fd);
+        fd = -1;
+#else
+        buffer.clear();
+#endif
+        data = nullptr;
+        size = 0;
+    }
+};
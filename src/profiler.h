@@ -0,0 +1,144 @@
+#pragma once
+//Sampling guest profiler (--profile). Every interval retired instructions a hart records where it
+//is: the PC, and with --profile-stacks the call stack as well. The stack is a shadow stack kept
+//from the JAL/JALR link-register hints, the same ones the return address stack of the branch
+//predictor follows: x1/x5 as rd is a call, as rs1 a return. Samples are keyed by raw addresses
+//and only named at the end, from the ELF .symtab, into folded stacks ("main;foo;bar 42") that
+//flamegraph.pl and speedscope read, and into a flat per-function report.
+#include<algorithm>
+#include<cstdint>
+#include<cstdio>
+#include<fstream>
+#include<map>
+#include<string>
+#include<vector>
+
+static const uint32_t PROFILE_MAX_DEPTH = 1024; //Deeper calls are only counted, not recorded
+
+struct Guest_Symbol{
+    uint32_t addr;
+    uint32_t size;  //0 = unknown, the symbol then runs up to the next one
+    std::string name;
+};
+
+struct Symbol_Table{    //Code symbols of the loaded ELF, sorted by address
+    std::vector<Guest_Symbol> symbols;
+
+    void Add(uint32_t addr, uint32_t size, const std::string& name){ symbols.push_back({addr, size, name}); }
+
+    void Sort(){    //Call once after the last Add; of several symbols at one address the sized one wins
+        std::stable_sort(symbols.begin(), symbols.end(), [](const Guest_Symbol& a, const Guest_Symbol& b){
+            return a.addr < b.addr || (a.addr == b.addr && a.size > b.size);
+        });
+        symbols.erase(std::unique(symbols.begin(), symbols.end(), [](const Guest_Symbol& a, const Guest_Symbol& b){
+            return a.addr == b.addr;
+        }), symbols.end());
+    }
+
+    std::string Name(uint32_t pc) const {   //Function holding pc, its address in hex if there is none
+        auto it = std::upper_bound(symbols.begin(), symbols.end(), pc, [](uint32_t value, const Guest_Symbol& s){
+            return value < s.addr;
+        });
+        if(it != symbols.begin()){
+            --it;
+            if(it->size == 0 || pc - it->addr < it->size) return it->name;
+        }
+        char hex[16];
+        std::snprintf(hex, sizeof(hex), "0x%08x", pc);
+        return hex;
+    }
+};
+
+struct Profiler{    //One hart's samples
+    uint64_t interval;
+    uint64_t next_sample;   //inst_count of the next sample
+    bool stacks;
+    std::vector<uint32_t> frames;   //Return addresses of the active calls, outermost first
+    uint32_t untracked = 0; //Calls beyond PROFILE_MAX_DEPTH that are still active
+    std::map<std::vector<uint32_t>, uint64_t> samples;  //Call sites (outermost first) then the PC
+
+    Profiler(uint64_t interval, bool stacks) : interval(interval), next_sample(interval), stacks(stacks) {}
+
+    //JAL (rs1 = 0) or JALR at pc, link the address after it; same hints as Branch_Unit::Jump
+    void Jump(uint32_t, uint32_t link, uint32_t target, uint32_t rd, uint32_t rs1){
+        if(!stacks) return;
+        bool rd_link = rd == 1 || rd == 5;
+        bool rs1_link = rs1 == 1 || rs1 == 5;
+
+        if(rs1_link && rd != rs1){  //Return: unwind to the frame it goes back to, if it is one of ours
+            if(untracked) untracked--;
+            else{
+                size_t depth = frames.size();
+                while(depth > 0 && frames[depth - 1] != target) depth--;
+                if(depth > 0) frames.resize(depth - 1);
+            }
+        }
+        if(rd_link){
+            if(frames.size() < PROFILE_MAX_DEPTH) frames.push_back(link);
+            else untracked++;
+        }
+    }
+
+    void Sample(uint32_t pc, uint64_t inst_count){
+        std::vector<uint32_t> key;
+        if(stacks){
+            key.reserve(frames.size() + 1);
+            for(uint32_t ret : frames) key.push_back(ret - 2);  //Inside the call, whether it was compressed or not
+        }
+        key.push_back(pc);
+        samples[key]++;
+        next_sample = inst_count + interval;
+    }
+};
+
+struct Profile_Function{
+    std::string name;
+    uint64_t self = 0;  //Samples with the PC in the function
+    uint64_t total = 0; //Samples with the function anywhere on the stack
+};
+
+struct Profile{ //Samples of every hart, named
+    std::map<std::string, uint64_t> folded; //"outer;...;leaf" -> samples
+    std::map<std::string, Profile_Function> functions;
+    uint64_t samples = 0;
+
+    //Adds a hart's samples; prefix (e.g. "hart1") becomes the root frame so harts stay apart
+    void Add(const Profiler& profiler, const Symbol_Table& symbols, const std::string& prefix){
+        for(const auto& sample : profiler.samples){
+            std::vector<std::string> names;
+            for(uint32_t pc : sample.first) names.push_back(symbols.Name(pc));
+
+            std::string stack = prefix;
+            for(const auto& name : names) stack += (stack.empty() ? "" : ";") + name;
+            folded[stack] += sample.second;
+            samples += sample.second;
+
+            Profile_Function& leaf = functions[names.back()];
+            leaf.name = names.back();
+            leaf.self += sample.second;
+            std::sort(names.begin(), names.end());
+            names.erase(std::unique(names.begin(), names.end()), names.end());  //Recursion counts once
+            for(const auto& name : names){
+                functions[name].name = name;
+                functions[name].total += sample.second;
+            }
+        }
+    }
+
+    bool Write_Folded(const std::string& path) const {
+        std::ofstream file(path, std::ios::trunc);
+        if(!file.is_open()) return false;
+        for(const auto& stack : folded) file << stack.first << ' ' << stack.second << '\n';
+        return (bool)file;
+    }
+
+    std::vector<Profile_Function> Top(size_t count) const {  //Most self samples first
+        std::vector<Profile_Function> top;
+        for(const auto& entry : functions) top.push_back(entry.second);
+        std::stable_sort(top.begin(), top.end(), [](const Profile_Function& a, const Profile_Function& b){
+            return a.self > b.self || (a.self == b.self && a.total > b.total);
+        });
+        if(top.size() > count) top.resize(count);
+        return top;
+    }
+};
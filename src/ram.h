@@ -0,0 +1,113 @@
+#pragma once
+//Guest RAM regions. Each region is reserved straight from the OS, which hands out zeroed
+//pages on first touch, so an instance only commits the memory its guest actually uses.
+#include<cstdint>
+#include<cstdlib>
+#include<string>
+#include<vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include<windows.h>
+#else
+#include<sys/mman.h>
+#endif
+
+#if defined(_MSC_VER)
+#include<intrin.h>
+#endif
+
+static const uint32_t PAGE_SHIFT = 12;  //Guest pages are 4 KiB
+static const uint32_t PAGE_SIZE = 1 << PAGE_SHIFT;
+
+struct Ram_Region{  //Guest addresses [base, base + size) live at host[0, size)
+    uint32_t base = 0;
+    uint32_t size = 0;
+    uint8_t* host = nullptr;
+    std::vector<uint8_t> dirty; //One flag per page written since the last snapshot
+
+    bool Contains(uint32_t addr, uint32_t len) const{
+        uint32_t offset = addr - base;
+        return offset < size && len <= size - offset;
+    }
+
+    bool Overlaps(const Ram_Region& other) const{
+        return (uint64_t)base < (uint64_t)other.base + other.size && (uint64_t)other.base < (uint64_t)base + size;
+    }
+
+    bool Allocate(){    //Reserves the backing store; nothing is committed until the guest touches it
+        Release();
+#ifdef _WIN32
+        host = static_cast<uint8_t*>(VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+#else
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        host = (p == MAP_FAILED) ? nullptr : static_cast<uint8_t*>(p);
+#endif
+        dirty.assign(size >> PAGE_SHIFT, 0);
+        return host != nullptr;
+    }
+
+    void Mark_Dirty(uint32_t addr, uint32_t len){   //[addr, addr + len) must be inside the region
+        dirty[(addr - base) >> PAGE_SHIFT] = 1;
+        dirty[(addr + len - 1 - base) >> PAGE_SHIFT] = 1;
+    }
+
+    void Release(){
+        if(!host) return;
+#ifdef _WIN32
+        VirtualFree(host, 0, MEM_RELEASE);
+#else
+        munmap(host, size);
+#endif
+        host = nullptr;
+    }
+};
+
+//Parses a --ram value "SIZE[@BASE]", SIZE in bytes with an optional K/M/G suffix
+inline bool Parse_Ram_Option(const std::string& text, Ram_Region& region, bool& has_base){
+    size_t at = text.find('@');
+    std::string size_text = text.substr(0, at);
+    has_base = at != std::string::npos;
+
+    char* end = nullptr;
+    unsigned long long size = std::strtoull(size_text.c_str(), &end, 0);
+    if(end == size_text.c_str()) return false;
+    if(*end == 'K' || *end == 'k'){ size <<= 10; end++; }
+    else if(*end == 'M' || *end == 'm'){ size <<= 20; end++; }
+    else if(*end == 'G' || *end == 'g'){ size <<= 30; end++; }
+    if(*end != '\0' || size == 0 || size > 0xFFFFF000ull || (size & 0xFFF)) return false;
+    region.size = (uint32_t)size;
+
+    if(has_base){
+        std::string base_text = text.substr(at + 1);
+        unsigned long long base = std::strtoull(base_text.c_str(), &end, 0);
+        if(end == base_text.c_str() || *end != '\0' || (base & 0xFFF) || base + size > 0x100000000ull) return false;
+        region.base = (uint32_t)base;
+    }
+    return true;
+}
+
+//Host atomics on guest RAM words for the A extension; p must be 4 byte aligned
+inline uint32_t Host_Load32(uint32_t* p){
+#if defined(__GNUC__)
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+#else
+    return (uint32_t)_InterlockedOr(reinterpret_cast<volatile long*>(p), 0);
+#endif
+}
+
+inline bool Host_CAS32(uint32_t* p, uint32_t& expected, uint32_t desired){ //On failure expected gets the current value
+#if defined(__GNUC__)
+    return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#else
+    uint32_t seen = (uint32_t)_InterlockedCompareExchange(reinterpret_cast<volatile long*>(p), (long)desired, (long)expected);
+    bool ok = seen == expected;
+    expected = seen;
+    return ok;
+#endif
+}
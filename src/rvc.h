@@ -0,0 +1,111 @@
+#pragma once
+//RV32C: expands a 16-bit compressed instruction into the 32-bit instruction it stands for, so the
+//rest of the emulator only ever decodes and executes RV32I/M/A. DECODE calls this once per
+//instruction; the decode cache keeps the result next to the original parcel.
+#include<cstdint>
+
+//32-bit encodings of the formats the compressed instructions map to
+inline uint32_t RVC_I(uint32_t op, uint32_t rd, uint32_t func3, uint32_t rs1, int32_t imm){
+    return ((uint32_t)imm << 20) | (rs1 << 15) | (func3 << 12) | (rd << 7) | op;
+}
+inline uint32_t RVC_S(uint32_t op, uint32_t func3, uint32_t rs1, uint32_t rs2, int32_t imm){
+    return (((uint32_t)imm >> 5 & 0x7F) << 25) | (rs2 << 20) | (rs1 << 15) | (func3 << 12) | (((uint32_t)imm & 0x1F) << 7) | op;
+}
+inline uint32_t RVC_R(uint32_t func7, uint32_t rd, uint32_t func3, uint32_t rs1, uint32_t rs2){
+    return (func7 << 25) | (rs2 << 20) | (rs1 << 15) | (func3 << 12) | (rd << 7) | 0x33;
+}
+inline uint32_t RVC_B(uint32_t func3, uint32_t rs1, int32_t imm){  //Compared against x0
+    uint32_t u = (uint32_t)imm;
+    return ((u >> 12 & 1) << 31) | ((u >> 5 & 0x3F) << 25) | (rs1 << 15) | (func3 << 12)
+        | ((u >> 1 & 0xF) << 8) | ((u >> 11 & 1) << 7) | 0x63;
+}
+inline uint32_t RVC_J(uint32_t rd, int32_t imm){
+    uint32_t u = (uint32_t)imm;
+    return ((u >> 20 & 1) << 31) | ((u >> 1 & 0x3FF) << 21) | ((u >> 11 & 1) << 20) | ((u >> 12 & 0xFF) << 12) | (rd << 7) | 0x6F;
+}
+
+inline uint32_t RVC_Bits(uint32_t c, int high, int low){ return (c >> low) & ((1u << (high - low + 1)) - 1); }
+inline int32_t RVC_Sext(uint32_t value, int bits){ return (int32_t)(value << (32 - bits)) >> (32 - bits); }
+
+//Returns the 32-bit equivalent of the parcel c, 0 for reserved encodings and the floating-point ones
+//(no F/D here). Registers written rd'/rs1'/rs2' in the spec are x8-x15.
+inline uint32_t EXPAND_COMPRESSED(uint32_t c){
+    uint32_t func3 = RVC_Bits(c, 15, 13);
+    uint32_t rd = RVC_Bits(c, 11, 7);   //Also rs1 of the register-register forms
+    uint32_t rs2 = RVC_Bits(c, 6, 2);
+    uint32_t rd_c = 8 + RVC_Bits(c, 4, 2);  //rd' / rs2'
+    uint32_t rs1_c = 8 + RVC_Bits(c, 9, 7);
+    int32_t imm6 = RVC_Sext((RVC_Bits(c, 12, 12) << 5) | rs2, 6);   //C.ADDI, C.LI, C.ANDI
+    int32_t jump = RVC_Sext((RVC_Bits(c, 12, 12) << 11) | (RVC_Bits(c, 11, 11) << 4) | (RVC_Bits(c, 10, 9) << 8)
+        | (RVC_Bits(c, 8, 8) << 10) | (RVC_Bits(c, 7, 7) << 6) | (RVC_Bits(c, 6, 6) << 7)
+        | (RVC_Bits(c, 5, 3) << 1) | (RVC_Bits(c, 2, 2) << 5), 12);
+    int32_t branch = RVC_Sext((RVC_Bits(c, 12, 12) << 8) | (RVC_Bits(c, 11, 10) << 3) | (RVC_Bits(c, 6, 5) << 6)
+        | (RVC_Bits(c, 4, 3) << 1) | (RVC_Bits(c, 2, 2) << 5), 9);
+    uint32_t word_offset = (RVC_Bits(c, 12, 10) << 3) | (RVC_Bits(c, 6, 6) << 2) | (RVC_Bits(c, 5, 5) << 6);  //C.LW, C.SW
+
+    switch(c & 3){
+        case 0:
+            switch(func3){
+                case 0x0:{  //C.ADDI4SPN
+                    uint32_t imm = (RVC_Bits(c, 12, 11) << 4) | (RVC_Bits(c, 10, 7) << 6) | (RVC_Bits(c, 6, 6) << 2) | (RVC_Bits(c, 5, 5) << 3);
+                    return imm ? RVC_I(0x13, rd_c, 0x0, 2, imm) : 0;
+                }
+                case 0x2: return RVC_I(0x03, rd_c, 0x2, rs1_c, word_offset);   //C.LW
+                case 0x6: return RVC_S(0x23, 0x2, rs1_c, rd_c, word_offset);   //C.SW
+            }
+            return 0;
+        case 1:
+            switch(func3){
+                case 0x0: return RVC_I(0x13, rd, 0x0, rd, imm6);    //C.ADDI (C.NOP)
+                case 0x1: return RVC_J(1, jump);    //C.JAL
+                case 0x2: return RVC_I(0x13, rd, 0x0, 0, imm6);    //C.LI
+                case 0x3:
+                    if(rd == 2){    //C.ADDI16SP
+                        int32_t imm = RVC_Sext((RVC_Bits(c, 12, 12) << 9) | (RVC_Bits(c, 6, 6) << 4) | (RVC_Bits(c, 5, 5) << 6)
+                            | (RVC_Bits(c, 4, 3) << 7) | (RVC_Bits(c, 2, 2) << 5), 10);
+                        return imm ? RVC_I(0x13, 2, 0x0, 2, imm) : 0;
+                    }
+                    if(imm6 == 0) return 0;
+                    return ((uint32_t)imm6 << 12) | (rd << 7) | 0x37;  //C.LUI
+                case 0x4:
+                    switch(RVC_Bits(c, 11, 10)){
+                        case 0x0: return RVC_Bits(c, 12, 12) ? 0 : RVC_I(0x13, rs1_c, 0x5, rs1_c, rs2);  //C.SRLI (shamt[5] is RV64 only)
+                        case 0x1: return RVC_Bits(c, 12, 12) ? 0 : RVC_I(0x13, rs1_c, 0x5, rs1_c, 0x400 | rs2);  //C.SRAI
+                        case 0x2: return RVC_I(0x13, rs1_c, 0x7, rs1_c, imm6);    //C.ANDI
+                    }
+                    if(RVC_Bits(c, 12, 12)) return 0;   //RV64 C.SUBW/C.ADDW
+                    switch(RVC_Bits(c, 6, 5)){
+                        case 0x0: return RVC_R(0x20, rs1_c, 0x0, rs1_c, rd_c); //C.SUB
+                        case 0x1: return RVC_R(0x00, rs1_c, 0x4, rs1_c, rd_c); //C.XOR
+                        case 0x2: return RVC_R(0x00, rs1_c, 0x6, rs1_c, rd_c); //C.OR
+                    }
+                    return RVC_R(0x00, rs1_c, 0x7, rs1_c, rd_c);   //C.AND
+                case 0x5: return RVC_J(0, jump);    //C.J
+                case 0x6: return RVC_B(0x0, rs1_c, branch);    //C.BEQZ
+                case 0x7: return RVC_B(0x1, rs1_c, branch);    //C.BNEZ
+            }
+            return 0;
+        case 2:
+            switch(func3){
+                case 0x0: return RVC_Bits(c, 12, 12) ? 0 : RVC_I(0x13, rd, 0x1, rd, rs2);   //C.SLLI
+                case 0x2:{  //C.LWSP
+                    uint32_t imm = (RVC_Bits(c, 12, 12) << 5) | (RVC_Bits(c, 6, 4) << 2) | (RVC_Bits(c, 3, 2) << 6);
+                    return rd ? RVC_I(0x03, rd, 0x2, 2, imm) : 0;
+                }
+                case 0x4:
+                    if(RVC_Bits(c, 12, 12) == 0){
+                        if(rs2) return RVC_R(0x00, rd, 0x0, 0, rs2);   //C.MV
+                        return rd ? RVC_I(0x67, 0, 0x0, rd, 0) : 0;    //C.JR
+                    }
+                    if(rs2) return RVC_R(0x00, rd, 0x0, rd, rs2);  //C.ADD
+                    if(rd) return RVC_I(0x67, 1, 0x0, rd, 0);  //C.JALR
+                    return 0x00100073;  //C.EBREAK
+                case 0x6:{  //C.SWSP
+                    uint32_t imm = (RVC_Bits(c, 12, 9) << 2) | (RVC_Bits(c, 8, 7) << 6);
+                    return RVC_S(0x23, 0x2, 2, rs2, imm);
+                }
+            }
+            return 0;
+    }
+    return c;   //Not compressed
+}
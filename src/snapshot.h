@@ -0,0 +1,108 @@
+#pragma once
+//Snapshot file helpers. A snapshot is the machine state followed by guest RAM pages; a
+//full snapshot stores every non-zero page, an incremental one only the pages written since
+//its parent snapshot and names that parent so restore can replay the chain.
+//
+//Layout (host byte order):
+//  "RVSNAP06"  parent path (u32 length + bytes, empty for a full snapshot)
+//  machine state (written field by field by RISC_V::SAVE_SNAPSHOT)
+//  page records: u32 guest address, u16 packed length (PAGE_RAW_FLAG = stored as is), data
+//  end marker: guest address SNAPSHOT_END
+#include<cstdint>
+#include<cstring>
+#include<fstream>
+#include<string>
+#include<vector>
+
+static const char SNAPSHOT_MAGIC[8] = {'R', 'V', 'S', 'N', 'A', 'P', '0', '6'};  //06: CLINT msip
+static const uint32_t SNAPSHOT_END = 0xFFFFFFFF;   //Page records never start here (not page aligned)
+static const uint16_t PAGE_RAW_FLAG = 0x8000;
+
+struct Snapshot_Out{
+    std::ofstream file;
+
+    bool Open(const std::string& path){
+        file.open(path, std::ios::binary | std::ios::trunc);
+        if(file.is_open()) file.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        return file.is_open();
+    }
+
+    void Put(const void* data, size_t size){ file.write(static_cast<const char*>(data), size); }
+    template<typename T> void Put(const T& value){ Put(&value, sizeof(T)); }
+
+    void Put_String(const std::string& text){
+        Put((uint32_t)text.size());
+        Put(text.data(), text.size());
+    }
+
+    bool Ok(){ return (bool)file; }
+};
+
+struct Snapshot_In{
+    std::ifstream file;
+
+    bool Open(const std::string& path){
+        file.open(path, std::ios::binary);
+        char magic[sizeof(SNAPSHOT_MAGIC)];
+        return file.is_open() && file.read(magic, sizeof(magic)) && std::memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+    }
+
+    bool Get(void* data, size_t size){ return (bool)file.read(static_cast<char*>(data), size); }
+    template<typename T> bool Get(T& value){ return Get(&value, sizeof(T)); }
+
+    bool Get_String(std::string& text){
+        uint32_t size;
+        if(!Get(size) || size > 4096) return false;
+        text.resize(size);
+        return size == 0 || Get(&text[0], size);
+    }
+};
+
+//Run-length packs one page: a control byte c < 0x80 is followed by c + 1 literal bytes,
+//c >= 0x80 repeats the next byte c - 0x80 + 3 times. Zero-filled and pattern-filled memory
+//(the bulk of a typical guest) shrinks to a few bytes per page.
+inline void Pack_Page(const uint8_t* page, uint32_t size, std::vector<uint8_t>& out){
+    out.clear();
+    uint32_t i = 0;
+    while(i < size){
+        uint32_t run = 1;
+        while(i + run < size && run < 130 && page[i + run] == page[i]) run++;
+
+        if(run >= 3){
+            out.push_back((uint8_t)(0x80 + run - 3));
+            out.push_back(page[i]);
+            i += run;
+            continue;
+        }
+
+        uint32_t start = i, count = 0;  //Literals until the next run of 3 or 128 bytes
+        while(i < size && count < 128){
+            if(i + 2 < size && page[i] == page[i + 1] && page[i] == page[i + 2]) break;
+            i++;
+            count++;
+        }
+        out.push_back((uint8_t)(count - 1));
+        out.insert(out.end(), page + start, page + start + count);
+    }
+}
+
+inline bool Unpack_Page(const uint8_t* in, uint32_t length, uint8_t* page, uint32_t size){
+    uint32_t pos = 0, at = 0;
+    while(pos < length){
+        uint8_t c = in[pos++];
+        if(c < 0x80){
+            uint32_t count = c + 1u;
+            if(pos + count > length || at + count > size) return false;
+            std::memcpy(page + at, in + pos, count);
+            pos += count;
+            at += count;
+        }
+        else{
+            uint32_t count = c - 0x80u + 3;
+            if(pos >= length || at + count > size) return false;
+            std::memset(page + at, in[pos++], count);
+            at += count;
+        }
+    }
+    return at == size;
+}
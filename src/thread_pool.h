@@ -0,0 +1,63 @@
+#pragma once
+//Work-stealing pool for batch runs. Every worker owns a deque of task indices: it takes work
+//from the back of its own deque and, once that is empty, steals from the front of the others,
+//so a worker stuck on one long job never holds up the short ones queued behind it.
+#include<cstddef>
+#include<deque>
+#include<functional>
+#include<mutex>
+#include<thread>
+#include<vector>
+
+struct Work_Queue{
+    std::mutex lock;
+    std::deque<size_t> tasks;
+
+    bool Pop_Back(size_t& task){    //Owner end
+        std::lock_guard<std::mutex> guard(lock);
+        if(tasks.empty()) return false;
+        task = tasks.back();
+        tasks.pop_back();
+        return true;
+    }
+
+    bool Steal(size_t& task){   //Thief end
+        std::lock_guard<std::mutex> guard(lock);
+        if(tasks.empty()) return false;
+        task = tasks.front();
+        tasks.pop_front();
+        return true;
+    }
+};
+
+struct Thread_Pool{
+    unsigned workers;
+
+    explicit Thread_Pool(unsigned workers) : workers(workers ? workers : 1){}
+
+    //Runs run(0) .. run(count - 1) and returns once all of them are done. Tasks never queue
+    //new work, so a worker that finds every deque empty can stop.
+    void Run(size_t count, const std::function<void(size_t)>& run){
+        std::vector<Work_Queue> queues(workers);
+        for(size_t i = 0; i < count; i++){  //Contiguous chunks, first task of each chunk at the back
+            queues[i * workers / count].tasks.push_front(i);
+        }
+
+        auto work = [&](unsigned self){
+            size_t task;
+            for(;;){
+                bool found = queues[self].Pop_Back(task);
+                for(unsigned k = 1; !found && k < workers; k++){
+                    found = queues[(self + k) % workers].Steal(task);
+                }
+                if(!found) return;
+                run(task);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for(unsigned w = 1; w < workers; w++) threads.emplace_back(work, w);
+        work(0);
+        for(auto& thread : threads) thread.join();
+    }
+};
@@ -0,0 +1,236 @@
+#pragma once
+//Execution traces. The flight recorder keeps the last TRACE_SIZE records in memory; with
+//--trace it also hands every full ring to a Trace_Stream, which encodes the records into large
+//blocks and writes them from a background thread.
+//
+//File layout (little-endian):
+//  "RVTRACE2"  u32 hart id
+//  blocks: u32 raw size, u32 stored size (TRACE_COMPRESSED set: Lz_Compress output), data
+//Records are one stream across blocks. Each is a varint of (zigzag(pc - fall-through of the
+//previous record) << 1), where the fall-through is 2 or 4 bytes (INST_LENGTH of the raw word).
+//Bit 0 is set when the raw word follows as a u32: that is only the case when the PC misses in
+//a direct-mapped dictionary of seen instructions, which the reader rebuilds the same way. Straight
+//line code that has run before costs one byte per instruction.
+#include<cstdint>
+#include<cstring>
+#include<condition_variable>
+#include<deque>
+#include<fstream>
+#include<mutex>
+#include<string>
+#include<thread>
+#include<vector>
+
+#include "isa.h"
+#include "lz_block.h"
+
+struct TraceRecord{ //Struct to hold trace buffer records
+    uint32_t pc;
+    uint32_t raw;
+};
+
+static const char TRACE_MAGIC[8] = {'R', 'V', 'T', 'R', 'A', 'C', 'E', '2'};
+static const uint32_t TRACE_BLOCK_SIZE = 1 << 20;   //Records are flushed in blocks of about this many bytes
+static const uint32_t TRACE_COMPRESSED = 0x80000000;
+static const uint32_t TRACE_QUEUE_DEPTH = 4;    //Blocks waiting for the writer before the hart blocks
+static const uint32_t TRACE_DICT_BITS = 16;
+static const uint32_t TRACE_RECORD_MAX = 9; //5 byte varint + raw word
+
+struct Trace_Coder{ //Encoder and decoder state: where the previous record falls through to and the instruction dictionary
+    uint32_t next_pc = 4;
+    std::vector<uint64_t> dictionary = std::vector<uint64_t>(1u << TRACE_DICT_BITS, UINT64_MAX);
+
+    uint64_t& Slot(uint32_t pc){ return dictionary[(pc >> 1) & ((1u << TRACE_DICT_BITS) - 1)]; }
+
+    void Encode(uint32_t pc, uint32_t raw, std::vector<uint8_t>& out){
+        uint32_t delta = pc - next_pc;
+        uint64_t& slot = Slot(pc);
+        uint64_t entry = ((uint64_t)pc << 32) | raw;
+        bool known = slot == entry;
+        slot = entry;
+        next_pc = pc + INST_LENGTH(raw);
+
+        uint64_t value = ((uint64_t)((delta << 1) ^ (uint32_t)((int32_t)delta >> 31)) << 1) | (known ? 0 : 1);
+        while(value >= 0x80){
+            out.push_back((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((uint8_t)value);
+
+        if(!known){
+            for(int i = 0; i < 4; i++) out.push_back((uint8_t)(raw >> (8 * i)));
+        }
+    }
+
+    bool Decode(const uint8_t* in, size_t size, size_t& pos, uint32_t& pc, uint32_t& raw){
+        uint64_t value = 0;
+        for(int shift = 0;; shift += 7){
+            if(pos >= size || shift > 35) return false;
+            uint8_t byte = in[pos++];
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if(!(byte & 0x80)) break;
+        }
+
+        uint32_t zigzag = (uint32_t)(value >> 1);
+        uint32_t delta = (zigzag >> 1) ^ (0u - (zigzag & 1));
+        pc = next_pc + delta;
+
+        uint64_t& slot = Slot(pc);
+        if(value & 1){
+            if(size - pos < 4) return false;
+            raw = in[pos] | (in[pos + 1] << 8) | (in[pos + 2] << 16) | ((uint32_t)in[pos + 3] << 24);
+            pos += 4;
+            slot = ((uint64_t)pc << 32) | raw;
+        }
+        else raw = (uint32_t)slot;
+        next_pc = pc + INST_LENGTH(raw);
+        return true;
+    }
+};
+
+struct Trace_Stream{    //Writes one hart's trace; Append runs on the hart, file I/O on a writer thread
+    std::ofstream file;
+    bool compress = false;
+    Trace_Coder coder;
+    std::vector<uint8_t> block;
+    uint64_t records = 0;
+
+    std::thread writer;
+    std::mutex lock;
+    std::condition_variable ready;  //Writer: a block is queued or the stream is closing
+    std::condition_variable drained;    //Hart: the queue has room again
+    std::deque<std::vector<uint8_t>> queue;
+    bool closing = false;
+    bool failed = false;
+
+    ~Trace_Stream(){ Close(); }
+
+    bool Open(const std::string& path, uint32_t hart, bool compressed){
+        file.open(path, std::ios::binary | std::ios::trunc);
+        if(!file.is_open()) return false;
+        file.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        file.write(reinterpret_cast<const char*>(&hart), sizeof(hart));
+
+        compress = compressed;
+        block.reserve(TRACE_BLOCK_SIZE + 64 * TRACE_RECORD_MAX);
+        writer = std::thread(&Trace_Stream::Write_Loop, this);
+        return true;
+    }
+
+    void Append(const TraceRecord* trace, int count){
+        for(int i = 0; i < count; i++) coder.Encode(trace[i].pc, trace[i].raw, block);
+        records += count;
+        if(block.size() >= TRACE_BLOCK_SIZE) Submit();
+    }
+
+    void Submit(){  //Hands the current block to the writer, waiting if it is TRACE_QUEUE_DEPTH behind
+        std::unique_lock<std::mutex> guard(lock);
+        drained.wait(guard, [&]{ return queue.size() < TRACE_QUEUE_DEPTH; });
+        queue.push_back(std::move(block));
+        ready.notify_one();
+
+        block = std::vector<uint8_t>();
+        block.reserve(TRACE_BLOCK_SIZE + 64 * TRACE_RECORD_MAX);
+    }
+
+    void Write_Loop(){
+        std::vector<uint8_t> packed;
+        for(;;){
+            std::vector<uint8_t> data;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                ready.wait(guard, [&]{ return !queue.empty() || closing; });
+                if(queue.empty()) return;
+                data = std::move(queue.front());
+                queue.pop_front();
+                drained.notify_one();
+            }
+
+            uint32_t raw_size = (uint32_t)data.size();
+            uint32_t stored_size = raw_size;
+            const uint8_t* stored = data.data();
+            if(compress){
+                Lz_Compress(data.data(), data.size(), packed);
+                if(packed.size() < data.size()){
+                    stored_size = (uint32_t)packed.size() | TRACE_COMPRESSED;
+                    stored = packed.data();
+                }
+            }
+
+            file.write(reinterpret_cast<const char*>(&raw_size), sizeof(raw_size));
+            file.write(reinterpret_cast<const char*>(&stored_size), sizeof(stored_size));
+            file.write(reinterpret_cast<const char*>(stored), stored_size & ~TRACE_COMPRESSED);
+            if(!file) failed = true;
+        }
+    }
+
+    bool Close(){   //Flushes everything still buffered; false if a write failed
+        if(!writer.joinable()) return !failed;
+        if(!block.empty()) Submit();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closing = true;
+        }
+        ready.notify_one();
+        writer.join();
+        file.close();
+        return !failed;
+    }
+};
+
+struct Trace_Reader{
+    std::ifstream file;
+    uint32_t hart = 0;
+    Trace_Coder coder;
+    std::vector<uint8_t> block, packed;
+    size_t pos = 0;
+    uint64_t blocks = 0;
+    uint64_t stored_bytes = 0;
+    bool corrupt = false;
+
+    bool Open(const std::string& path){
+        file.open(path, std::ios::binary);
+        char magic[sizeof(TRACE_MAGIC)];
+        return file.is_open() && file.read(magic, sizeof(magic)) && std::memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0
+            && file.read(reinterpret_cast<char*>(&hart), sizeof(hart));
+    }
+
+    bool Next(uint32_t& pc, uint32_t& raw){ //False at the end of the trace (check corrupt)
+        while(pos >= block.size()){
+            uint32_t raw_size, stored_size;
+            if(!file.read(reinterpret_cast<char*>(&raw_size), sizeof(raw_size))) return false;
+            if(!file.read(reinterpret_cast<char*>(&stored_size), sizeof(stored_size)) || raw_size > 64 * TRACE_BLOCK_SIZE){
+                corrupt = true;
+                return false;
+            }
+
+            uint32_t length = stored_size & ~TRACE_COMPRESSED;
+            std::vector<uint8_t>& target = (stored_size & TRACE_COMPRESSED) ? packed : block;
+            target.resize(length);
+            if(length > 64 * TRACE_BLOCK_SIZE || !file.read(reinterpret_cast<char*>(target.data()), length)){
+                corrupt = true;
+                return false;
+            }
+            if(stored_size & TRACE_COMPRESSED){
+                block.resize(raw_size);
+                if(!Lz_Decompress(packed.data(), length, block.data(), raw_size)){
+                    corrupt = true;
+                    return false;
+                }
+            }
+            else if(length != raw_size){
+                corrupt = true;
+                return false;
+            }
+            pos = 0;
+            blocks++;
+            stored_bytes += 8 + length;
+        }
+
+        if(!coder.Decode(block.data(), block.size(), pos, pc, raw)){
+            corrupt = true;
+            return false;
+        }
+        return true;
+    }
+};
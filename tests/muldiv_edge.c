@@ -0,0 +1,108 @@
+// RV32M edge cases against the values the spec defines: division by zero, the INT_MIN / -1
+// overflow and the signedness of MULH, MULHSU and MULHU. The instructions are issued with inline
+// asm, since C leaves these cases undefined, and every case runs ROUNDS times so the hot-block
+// tiers translate it too. Build with -march=rv32im_zicsr and run on every --core.
+#define UART_TX (*(volatile char *)0x10000000)
+
+void uart_putc(char c) { UART_TX = c; }
+
+void print_str(const char *str) {
+    while (*str) uart_putc(*str++);
+}
+
+void print_hex(unsigned long num) {
+    print_str("0x");
+    for (int i = 28; i >= 0; i -= 4) {
+        unsigned char nibble = (num >> i) & 0xF;
+        uart_putc(nibble < 10 ? '0' + nibble : 'A' + (nibble - 10));
+    }
+}
+
+#define RV_OP(name) \
+    static unsigned int op_##name(unsigned int a, unsigned int b) { \
+        unsigned int r; \
+        asm volatile (#name " %0, %1, %2" : "=r"(r) : "r"(a), "r"(b)); \
+        return r; \
+    }
+
+RV_OP(mul)
+RV_OP(mulh)
+RV_OP(mulhsu)
+RV_OP(mulhu)
+RV_OP(div)
+RV_OP(divu)
+RV_OP(rem)
+RV_OP(remu)
+
+struct Case {
+    const char *name;
+    unsigned int (*op)(unsigned int, unsigned int);
+    unsigned int a, b, expected;
+};
+
+static const struct Case cases[] = {
+    // Division by zero: the quotient is all ones, the remainder is the dividend
+    {"div  7 / 0",           op_div,    0x00000007, 0x00000000, 0xFFFFFFFF},
+    {"divu 7 / 0",           op_divu,   0x00000007, 0x00000000, 0xFFFFFFFF},
+    {"rem  -7 % 0",          op_rem,    0xFFFFFFF9, 0x00000000, 0xFFFFFFF9},
+    {"remu 7 % 0",           op_remu,   0x00000007, 0x00000000, 0x00000007},
+    {"rem  INT_MIN % 0",     op_rem,    0x80000000, 0x00000000, 0x80000000},
+    // Signed overflow: INT_MIN / -1 is INT_MIN with remainder 0
+    {"div  INT_MIN / -1",    op_div,    0x80000000, 0xFFFFFFFF, 0x80000000},
+    {"rem  INT_MIN % -1",    op_rem,    0x80000000, 0xFFFFFFFF, 0x00000000},
+    {"divu 2^31 / 2^32-1",   op_divu,   0x80000000, 0xFFFFFFFF, 0x00000000},
+    {"mul  INT_MIN * -1",    op_mul,    0x80000000, 0xFFFFFFFF, 0x80000000},
+    // Division rounds toward zero, the remainder takes the dividend's sign
+    {"div  -7 / 2",          op_div,    0xFFFFFFF9, 0x00000002, 0xFFFFFFFD},
+    {"rem  -7 % 2",          op_rem,    0xFFFFFFF9, 0x00000002, 0xFFFFFFFF},
+    {"divu 0xFFFFFFF9 / 2",  op_divu,   0xFFFFFFF9, 0x00000002, 0x7FFFFFFC},
+    {"remu 0xFFFFFFF9 % 2",  op_remu,   0xFFFFFFF9, 0x00000002, 0x00000001},
+    // High halves: signed x signed, signed x unsigned, unsigned x unsigned
+    {"mulh   -1 * -1",       op_mulh,   0xFFFFFFFF, 0xFFFFFFFF, 0x00000000},
+    {"mulh   INT_MIN^2",     op_mulh,   0x80000000, 0x80000000, 0x40000000},
+    {"mulh   INT_MIN * 1",   op_mulh,   0x80000000, 0x00000001, 0xFFFFFFFF},
+    {"mulh   INT_MAX * MIN", op_mulh,   0x7FFFFFFF, 0x80000000, 0xC0000000},
+    {"mulhsu -1 * 2^32-1",   op_mulhsu, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+    {"mulhsu MIN * 2^32-1",  op_mulhsu, 0x80000000, 0xFFFFFFFF, 0x80000000},
+    {"mulhsu MAX * 2^32-1",  op_mulhsu, 0x7FFFFFFF, 0xFFFFFFFF, 0x7FFFFFFE},
+    {"mulhu  (2^32-1)^2",    op_mulhu,  0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFE},
+    {"mulhu  2^31 * 2",      op_mulhu,  0x80000000, 0x00000002, 0x00000001},
+};
+
+#define CASES (sizeof(cases) / sizeof(cases[0]))
+#define ROUNDS 200
+
+void _start() {
+    unsigned int wrong[CASES];
+    unsigned int got[CASES];
+    int failed = 0;
+
+    for (unsigned int c = 0; c < CASES; c++) wrong[c] = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        for (unsigned int c = 0; c < CASES; c++) {
+            unsigned int r = cases[c].op(cases[c].a, cases[c].b);
+            if (r != cases[c].expected) {
+                wrong[c]++;
+                got[c] = r;
+            }
+        }
+    }
+
+    for (unsigned int c = 0; c < CASES; c++) {
+        print_str(cases[c].name);
+        if (wrong[c] == 0) {
+            print_str(": [PASS]\n");
+            continue;
+        }
+        print_str(": [FAIL] got ");
+        print_hex(got[c]);
+        print_str(", expected ");
+        print_hex(cases[c].expected);
+        uart_putc('\n');
+        failed = 1;
+    }
+
+    print_str(failed ? "muldiv_edge: [FAIL]\n" : "muldiv_edge: [PASS]\n");
+    asm volatile ("mv a0, %0; li a7, 93; ecall" : : "r"(failed) : "a0", "a7");
+}
@@ -0,0 +1,108 @@
+// RVC control flow and the decode cache's halfword slots. rvc_paths runs C.J, C.BEQZ (taken and
+// not taken) and C.JAL once at a word-aligned address and once two bytes past one; every path
+// adds its own bit to a0, and a wrong target or a C.JAL link of pc+4 instead of pc+2 changes the
+// sum. straddle runs a 32-bit ADDI whose halves sit on two pages. Both are called ROUNDS times,
+// so the hot-block tiers translate them too.
+// Build with -march=rv32imac_zicsr and run on every --core.
+#define UART_TX (*(volatile char *)0x10000000)
+
+void uart_putc(char c) { UART_TX = c; }
+
+void print_str(const char *str) {
+    while (*str) uart_putc(*str++);
+}
+
+void print_hex(unsigned long num) {
+    print_str("0x");
+    for (int i = 28; i >= 0; i -= 4) {
+        unsigned char nibble = (num >> i) & 0xF;
+        uart_putc(nibble < 10 ? '0' + nibble : 'A' + (nibble - 10));
+    }
+    uart_putc('\n');
+}
+
+// Explicit c.* mnemonics and .p2align/c.nop pin every branch to the alignment it tests;
+// "addi a0, a0, 0x400" sits on the paths that must be skipped
+unsigned int rvc_paths(void);
+unsigned int straddle(unsigned int x);    // Returns x + 0x123
+asm(".text\n"
+    ".option push\n"
+    ".option rvc\n"
+    ".option norelax\n"
+    ".globl rvc_paths\n"
+    ".p2align 2\n"
+    "rvc_paths:\n"
+    "    mv t1, ra\n"
+    "    li a0, 0\n"
+    "    li a1, 0\n"
+    "    li a2, 1\n"
+    // Word-aligned: 1 + 2 + 4 + 8 (rvc_sub) + 16
+    "    .p2align 2\n"
+    "    c.j 1f\n"
+    "    addi a0, a0, 0x400\n"
+    "1:  addi a0, a0, 1\n"
+    "    .p2align 2\n"
+    "    c.beqz a1, 2f\n"
+    "    addi a0, a0, 0x400\n"
+    "2:  addi a0, a0, 2\n"
+    "    .p2align 2\n"
+    "    c.beqz a2, 3f\n"
+    "    addi a0, a0, 4\n"
+    "3:  .p2align 2\n"
+    "    c.jal rvc_sub\n"
+    "    addi a0, a0, 16\n"
+    // Halfword-aligned: 32 + 64 + 128 + 8 (rvc_sub) + 256
+    "    .p2align 2\n"
+    "    c.nop\n"
+    "    c.j 4f\n"
+    "    addi a0, a0, 0x400\n"
+    "4:  addi a0, a0, 32\n"
+    "    .p2align 2\n"
+    "    c.nop\n"
+    "    c.beqz a1, 5f\n"
+    "    addi a0, a0, 0x400\n"
+    "5:  addi a0, a0, 64\n"
+    "    .p2align 2\n"
+    "    c.nop\n"
+    "    c.beqz a2, 6f\n"
+    "    addi a0, a0, 128\n"
+    "6:  .p2align 2\n"
+    "    c.nop\n"
+    "    c.jal rvc_sub\n"
+    "    addi a0, a0, 256\n"
+    "    mv ra, t1\n"
+    "    ret\n"
+    "rvc_sub:\n"
+    "    addi a0, a0, 8\n"
+    "    ret\n"
+    // Padding up to four bytes before a page boundary, never executed
+    ".p2align 12\n"
+    ".space 4092\n"
+    ".globl straddle\n"
+    "straddle:\n"
+    "    c.nop\n"
+    ".option norvc\n"
+    "    addi a0, a0, 0x123\n"  // Bytes 4094-4097: two on each page
+    ".option rvc\n"
+    "    ret\n"
+    ".option pop\n");
+
+#define PATHS_SUM 0x207
+#define ROUNDS 100
+
+void _start() {
+    unsigned int paths = 0, crossed = 0;
+    int failed = 0;
+
+    for (int i = 0; i < ROUNDS; i++) {
+        unsigned int p = rvc_paths();
+        unsigned int c = straddle(i);
+        if (p != PATHS_SUM) { failed = 1; paths = p; }
+        if (c != (unsigned int)i + 0x123) { failed = 1; crossed = c; }
+    }
+
+    if (paths) { print_str("rvc_paths: got "); print_hex(paths); }
+    if (crossed) { print_str("straddle: got "); print_hex(crossed); }
+    print_str(failed ? "rvc_paths: [FAIL]\n" : "rvc_paths: [PASS]\n");
+    asm volatile ("mv a0, %0; li a7, 93; ecall" : : "r"(failed) : "a0", "a7");
+}
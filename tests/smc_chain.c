@@ -0,0 +1,57 @@
+// Self-modifying code against the block cores: a hot loop calls add_k until the caller's block
+// is chained straight to it, then rewrites add_k's immediate and runs the loop again. The old
+// add_k block is retired and freed while the loop's link still points at it, so every round
+// checks that the link gets dropped and the new code runs. Run with --core=block (and jit).
+// .text has to be writable: add -Wl,-N to the usual build line.
+#define UART_TX (*(volatile char *)0x10000000)
+
+void uart_putc(char c) { UART_TX = c; }
+
+void print_str(const char *str) {
+    while (*str) uart_putc(*str++);
+}
+
+void print_hex(unsigned long num) {
+    print_str("0x");
+    for (int i = 28; i >= 0; i -= 4) {
+        unsigned char nibble = (num >> i) & 0xF;
+        uart_putc(nibble < 10 ? '0' + nibble : 'A' + (nibble - 10));
+    }
+    uart_putc('\n');
+}
+
+// int add_k(int x) { return x + K; }, kept uncompressed so the immediate sits in one known word
+int add_k(int x);
+asm(".text\n"
+    ".option push\n"
+    ".option norvc\n"
+    ".align 2\n"
+    ".globl add_k\n"
+    "add_k:\n"
+    "    addi a0, a0, 1\n"
+    "    ret\n"
+    ".option pop\n");
+
+#define ROUNDS 8
+#define CALLS 1000
+
+static int run(void) {
+    int x = 0;
+    for (int i = 0; i < CALLS; i++) x = add_k(x);
+    return x;
+}
+
+void _start() {
+    volatile unsigned int *code = (volatile unsigned int *)(void *)add_k;
+    int failed = 0;
+
+    for (int k = 1; k <= ROUNDS; k++) {
+        *code = ((unsigned int)k << 20) | (10 << 15) | (10 << 7) | 0x13;   // addi a0, a0, k
+        int sum = run();
+        print_hex(sum);
+        if (sum != k * CALLS) failed = 1;
+    }
+
+    print_str(failed ? "smc_chain: [FAIL]\n" : "smc_chain: [PASS]\n");
+    asm volatile ("mv a0, %0; li a7, 93; ecall" : : "r"(failed) : "a0", "a7");
+}
@@ -0,0 +1,109 @@
+// Multi-hart atomics and IPIs. Every hart adds ITERATIONS to one shared counter with AMOADD.W
+// and to another with an LR.W/SC.W loop; hart 0 waits for the others and checks both totals.
+// Hart 1 then raises hart 0's software interrupt through its CLINT msip register while hart 0
+// sits in WFI, and hart 0 checks that its handler ran with the software interrupt cause.
+// Build with -march=rv32ima_zicsr and run with --harts=2 (or HARTS) on every core.
+#define UART_TX (*(volatile char *)0x10000000)
+#define CLINT_MSIP ((volatile unsigned int *)0x02000000)   // One word per hart
+
+#define HARTS 2
+#define ITERATIONS 10000
+
+void uart_putc(char c) { UART_TX = c; }
+
+void print_str(const char *str) {
+    while (*str) uart_putc(*str++);
+}
+
+void print_hex(unsigned long num) {
+    print_str("0x");
+    for (int i = 28; i >= 0; i -= 4) {
+        unsigned char nibble = (num >> i) & 0xF;
+        uart_putc(nibble < 10 ? '0' + nibble : 'A' + (nibble - 10));
+    }
+    uart_putc('\n');
+}
+
+void assert(int condition, const char *name, int *failed) {
+    print_str(name);
+    print_str(": ");
+    if (condition) print_str("[PASS]\n");
+    else {
+        print_str("[FAIL]\n");
+        *failed = 1;
+    }
+}
+
+volatile int amo_counter;
+volatile int lrsc_counter;
+volatile int finished;      // Harts done counting
+volatile int ipi_armed;     // Hart 0 is ready for the software interrupt
+volatile int ipi_seen;
+volatile unsigned int ipi_cause;
+
+static unsigned int hart_id(void) {
+    unsigned int id;
+    asm volatile ("csrr %0, mhartid" : "=r"(id));
+    return id;
+}
+
+static void amo_add(volatile int *p, int value) {
+    asm volatile ("amoadd.w zero, %1, (%0)" : : "r"(p), "r"(value) : "memory");
+}
+
+static void lrsc_add(volatile int *p, int value) {
+    int tmp, fail;
+    asm volatile ("1: lr.w %0, (%2)\n"
+                  "   add %0, %0, %3\n"
+                  "   sc.w %1, %0, (%2)\n"
+                  "   bnez %1, 1b"
+                  : "=&r"(tmp), "=&r"(fail) : "r"(p), "r"(value) : "memory");
+}
+
+__attribute__((interrupt("machine"), aligned(4)))
+void trap_handler(void) {
+    unsigned int cause;
+    asm volatile ("csrr %0, mcause" : "=r"(cause));
+    ipi_cause = cause;
+    CLINT_MSIP[0] = 0;      // Lower the line before returning, or the trap fires again
+    ipi_seen = 1;
+}
+
+void _start() {
+    unsigned int id = hart_id();
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        amo_add(&amo_counter, 1);
+        lrsc_add(&lrsc_counter, 1);
+    }
+    amo_add(&finished, 1);
+
+    if (id != 0) {
+        if (id == 1) {
+            while (!ipi_armed) {}
+            CLINT_MSIP[0] = 1;
+        }
+        for (;;) {}
+    }
+
+    while (finished != HARTS) {}
+
+    int failed = 0;
+    print_hex(amo_counter);
+    assert(amo_counter == HARTS * ITERATIONS, "amoadd.w total", &failed);
+    print_hex(lrsc_counter);
+    assert(lrsc_counter == HARTS * ITERATIONS, "lr.w/sc.w total", &failed);
+
+    asm volatile ("csrw mtvec, %0" : : "r"(trap_handler));
+    asm volatile ("csrw mie, %0" : : "r"(1 << 3));      // MSIE
+    asm volatile ("csrs mstatus, %0" : : "r"(1 << 3));  // MIE
+    ipi_armed = 1;
+    while (!ipi_seen) asm volatile ("wfi");
+    asm volatile ("csrc mstatus, %0" : : "r"(1 << 3));
+
+    print_hex(ipi_cause);
+    assert(ipi_cause == 0x80000003, "msip interrupt", &failed);
+
+    print_str(failed ? "smp_atomics: [FAIL]\n" : "smp_atomics: [PASS]\n");
+    asm volatile ("mv a0, %0; li a7, 93; ecall" : : "r"(failed) : "a0", "a7");
+}
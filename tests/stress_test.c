@@ -27,7 +27,8 @@ void assert(int condition, const char* name) {
     }
 }
 
-// SOFTWARE MATH (Standard RV32I helpers)
+// SOFTWARE MATH (Standard RV32I helpers, only needed without the M extension)
+#ifndef __riscv_mul
 long __mulsi3(long a, long b) {
     long r = 0;
     while (b) {
@@ -69,6 +70,7 @@ long __modsi3(long a, long b) {
     }
     return neg ? -r : r;
 }
+#endif
 
 // --------------------------------------------------------------------
 // 2. CSR DEFINITIONS
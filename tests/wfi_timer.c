@@ -0,0 +1,92 @@
+// WFI with the timer armed. Each round sets mtimecmp DELTA ticks ahead, enables MTIE and waits
+// in a WFI loop until the handler has run. The handler records mtime, which must have reached
+// mtimecmp, and disarms the timer. minstret must move far less than mtime over the wait: the idle
+// hart skips ahead to the deadline instead of spinning towards it.
+// Build with -march=rv32im_zicsr and run with --core=switch and --core=jit.
+#define UART_TX (*(volatile char *)0x10000000)
+#define CLINT_MTIMECMP ((volatile unsigned int *)0x02004000)   // Hart 0: low word, high word
+#define CLINT_MTIME ((volatile unsigned int *)0x0200BFF8)
+
+#define DELTA 10000000
+#define ROUNDS 5
+
+void uart_putc(char c) { UART_TX = c; }
+
+void print_str(const char *str) {
+    while (*str) uart_putc(*str++);
+}
+
+void print_hex(unsigned long num) {
+    print_str("0x");
+    for (int i = 28; i >= 0; i -= 4) {
+        unsigned char nibble = (num >> i) & 0xF;
+        uart_putc(nibble < 10 ? '0' + nibble : 'A' + (nibble - 10));
+    }
+    uart_putc('\n');
+}
+
+static unsigned long long read_mtime(void) {
+    unsigned int hi, lo;
+    do {
+        hi = CLINT_MTIME[1];
+        lo = CLINT_MTIME[0];
+    } while (hi != CLINT_MTIME[1]);
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+static void set_mtimecmp(unsigned long long when) {
+    CLINT_MTIMECMP[1] = 0xFFFFFFFF;     // No early match while the halves are mixed
+    CLINT_MTIMECMP[0] = (unsigned int)when;
+    CLINT_MTIMECMP[1] = (unsigned int)(when >> 32);
+}
+
+static unsigned int read_minstret(void) {
+    unsigned int value;
+    asm volatile ("csrr %0, minstret" : "=r"(value));
+    return value;
+}
+
+volatile int fired;
+volatile unsigned int cause;
+volatile unsigned long long woke_at;
+
+__attribute__((interrupt("machine"), aligned(4)))
+void trap_handler(void) {
+    unsigned int c;
+    asm volatile ("csrr %0, mcause" : "=r"(c));
+    cause = c;
+    woke_at = read_mtime();
+    set_mtimecmp(0xFFFFFFFFFFFFFFFFULL);
+    fired = 1;
+}
+
+void _start() {
+    int failed = 0;
+
+    asm volatile ("csrw mtvec, %0" : : "r"(trap_handler));
+    asm volatile ("csrw mie, %0" : : "r"(1 << 7));      // MTIE
+    asm volatile ("csrs mstatus, %0" : : "r"(1 << 3));  // MIE
+
+    for (int round = 0; round < ROUNDS; round++) {
+        fired = 0;
+        unsigned long long deadline = read_mtime() + DELTA;
+        unsigned int instret = read_minstret();
+        set_mtimecmp(deadline);
+
+        while (!fired) asm volatile ("wfi");
+
+        unsigned int retired = read_minstret() - instret;
+        if (cause != 0x80000007 || woke_at < deadline || retired > DELTA / 100) {
+            print_str("round ");
+            print_hex(round);
+            print_hex(cause);
+            print_hex((unsigned int)(woke_at - (deadline - DELTA)));
+            print_hex(retired);
+            failed = 1;
+        }
+    }
+
+    asm volatile ("csrc mstatus, %0" : : "r"(1 << 3));
+    print_str(failed ? "wfi_timer: [FAIL]\n" : "wfi_timer: [PASS]\n");
+    asm volatile ("mv a0, %0; li a7, 93; ecall" : : "r"(failed) : "a0", "a7");
+}
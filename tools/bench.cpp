@@ -0,0 +1,461 @@
+//Emulator benchmark: writes a fixed set of guest workloads as ELF files, runs the emulator on each
+//(best of --runs) and reports host MIPS, ns per instruction and peak RSS as JSON.
+//Build: g++ -O2 -o bench tools/bench.cpp  (or the bench target of the CMake build)
+//Usage: ./bench --emulator=PATH [--out=FILE] [--runs=N] [--scale=N] [--dir=DIR] [-- EMULATOR_OPTIONS...]
+//
+//The workloads are hand-assembled RV32I below, so the suite needs no cross compiler and every
+//build measures exactly the same guest code.
+#include<algorithm>
+#include<cmath>
+#include<cstdint>
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<fstream>
+#include<iostream>
+#include<string>
+#include<vector>
+
+#ifndef _WIN32
+#include<fcntl.h>
+#include<sys/resource.h>
+#include<sys/stat.h>
+#include<sys/wait.h>
+#include<unistd.h>
+#endif
+
+static const uint32_t BENCH_BASE = 0x80000000;  //Code, then data at BENCH_DATA, one RWX segment
+static const uint32_t BENCH_DATA = 0x80100000;
+static const uint32_t BENCH_SIZE = 0x00600000;  //Segment size in memory, data past the code is zeroed
+static const uint32_t UART = 0x10000000;
+static const uint32_t CLINT_MTIMECMP = 0x02004000;
+static const uint32_t CLINT_MTIME = 0x0200BFF8;
+
+enum Reg{ ZERO, RA, SP, GP, TP, T0, T1, T2, S0, S1, A0, A1, A2, A3, A4, A5, A6, A7,
+          S2, S3, S4, S5, S6, S7, S8, S9, S10, S11, T3, T4, T5, T6 };
+
+struct Bench_Asm{   //Just enough of an assembler for the workloads: labels are indices, fixed up at the end
+    std::vector<uint32_t> code;
+    std::vector<uint32_t> labels;
+    struct Fixup{ size_t at; int label; bool jal; };
+    std::vector<Fixup> fixups;
+
+    uint32_t Here() const { return BENCH_BASE + (uint32_t)code.size() * 4; }
+    int Label(){ labels.push_back(0); return (int)labels.size() - 1; }
+    void Bind(int label){ labels[label] = Here(); }
+
+    void R(uint32_t f7, int rs2, int rs1, uint32_t f3, int rd, uint32_t op){ code.push_back(f7 << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | rd << 7 | op); }
+    void I(int32_t imm, int rs1, uint32_t f3, int rd, uint32_t op){ code.push_back((uint32_t)(imm & 0xFFF) << 20 | rs1 << 15 | f3 << 12 | rd << 7 | op); }
+    void S(int32_t imm, int rs2, int rs1, uint32_t f3){ code.push_back((uint32_t)(imm >> 5 & 0x7F) << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | (imm & 0x1F) << 7 | 0x23); }
+
+    void add(int rd, int a, int b){ R(0, b, a, 0, rd, 0x33); }
+    void sub(int rd, int a, int b){ R(0x20, b, a, 0, rd, 0x33); }
+    void xor_(int rd, int a, int b){ R(0, b, a, 4, rd, 0x33); }
+    void sltu(int rd, int a, int b){ R(0, b, a, 3, rd, 0x33); }
+    void addi(int rd, int rs, int32_t imm){ I(imm, rs, 0, rd, 0x13); }
+    void andi(int rd, int rs, int32_t imm){ I(imm, rs, 7, rd, 0x13); }
+    void slli(int rd, int rs, int sh){ I(sh, rs, 1, rd, 0x13); }
+    void srli(int rd, int rs, int sh){ I(sh, rs, 5, rd, 0x13); }
+    void lw(int rd, int32_t imm, int rs){ I(imm, rs, 2, rd, 0x03); }
+    void lbu(int rd, int32_t imm, int rs){ I(imm, rs, 4, rd, 0x03); }
+    void sw(int rs2, int32_t imm, int rs1){ S(imm, rs2, rs1, 2); }
+    void sb(int rs2, int32_t imm, int rs1){ S(imm, rs2, rs1, 0); }
+    void lui(int rd, uint32_t imm){ code.push_back((imm & 0xFFFFF000) | rd << 7 | 0x37); }
+    void li(int rd, uint32_t value){
+        uint32_t low = value & 0xFFF;
+        uint32_t high = value - (low >= 0x800 ? low - 0x1000 : low);
+        if(high) lui(rd, high);
+        if(low || !high) addi(rd, high ? rd : ZERO, (int32_t)(low << 20) >> 20);
+    }
+    void csrr(int rd, uint32_t csr){ I((int32_t)csr, 0, 2, rd, 0x73); }
+    void csrw(uint32_t csr, int rs){ I((int32_t)csr, rs, 1, 0, 0x73); }
+    void csrs(uint32_t csr, int rs){ I((int32_t)csr, rs, 2, 0, 0x73); }
+    void ecall(){ code.push_back(0x00000073); }
+    void mret(){ code.push_back(0x30200073); }
+    void ret(){ I(0, RA, 0, ZERO, 0x67); }
+
+    void branch(uint32_t f3, int a, int b, int label){
+        fixups.push_back({code.size(), label, false});
+        code.push_back(b << 20 | a << 15 | f3 << 12 | 0x63);
+    }
+    void beq(int a, int b, int label){ branch(0, a, b, label); }
+    void bne(int a, int b, int label){ branch(1, a, b, label); }
+    void jal(int rd, int label){
+        fixups.push_back({code.size(), label, true});
+        code.push_back(rd << 7 | 0x6F);
+    }
+
+    void exit(){    //exit(0) through the emulator's ecall 93
+        li(A0, 0);
+        li(A7, 93);
+        ecall();
+    }
+
+    void Finish(){
+        for(const auto& f : fixups){
+            int32_t offset = (int32_t)(labels[f.label] - (BENCH_BASE + (uint32_t)f.at * 4));
+            uint32_t o = (uint32_t)offset;
+            if(f.jal) code[f.at] |= (o & 0x100000) << 11 | (o & 0x7FE) << 20 | (o & 0x800) << 9 | (o & 0xFF000);
+            else code[f.at] |= (o & 0x1000) << 19 | (o & 0x7E0) << 20 | (o & 0x1E) << 7 | (o & 0x800) >> 4;
+        }
+    }
+};
+
+struct Workload{
+    std::string name;
+    std::string description;
+    Bench_Asm program;
+};
+
+//Integer ALU chain with a loop-carried dependency
+static Workload Alu(uint32_t scale){
+    Workload w{"alu", "register arithmetic loop", {}};
+    Bench_Asm& a = w.program;
+    a.li(S0, 6000000 * scale);
+    a.li(T0, 1);
+    a.li(T1, 0x12345);
+    int loop = a.Label();
+    a.Bind(loop);
+    a.add(T0, T0, T1);
+    a.xor_(T1, T1, T0);
+    a.slli(T2, T0, 3);
+    a.srli(T3, T1, 2);
+    a.sltu(T4, T2, T3);
+    a.add(T1, T1, T4);
+    a.sub(T0, T0, T3);
+    a.addi(S0, S0, -1);
+    a.bne(S0, ZERO, loop);
+    a.exit();
+    return w;
+}
+
+//Read-modify-write sweeps over a 4 MiB buffer
+static Workload Memory(uint32_t scale){
+    Workload w{"memory", "load/store streaming over 4 MiB", {}};
+    Bench_Asm& a = w.program;
+    a.li(S0, 8 * scale);
+    int pass = a.Label(), inner = a.Label();
+    a.Bind(pass);
+    a.li(A0, BENCH_DATA);
+    a.li(A1, BENCH_DATA + 0x400000);
+    a.Bind(inner);
+    a.lw(T0, 0, A0);
+    a.add(T1, T1, T0);
+    a.addi(T0, T0, 1);
+    a.sw(T0, 0, A0);
+    a.addi(A0, A0, 4);
+    a.bne(A0, A1, inner);
+    a.addi(S0, S0, -1);
+    a.bne(S0, ZERO, pass);
+    a.exit();
+    return w;
+}
+
+//xorshift32-driven branches nobody can predict, plus calls and returns
+static Workload Branch(uint32_t scale){
+    Workload w{"branch", "data-dependent branches and calls", {}};
+    Bench_Asm& a = w.program;
+    int loop = a.Label(), skip1 = a.Label(), skip2 = a.Label(), func = a.Label(), done = a.Label();
+    a.li(S0, 3000000 * scale);
+    a.li(S1, 2463534242u);
+    a.Bind(loop);
+    a.slli(T1, S1, 13);
+    a.xor_(S1, S1, T1);
+    a.srli(T1, S1, 17);
+    a.xor_(S1, S1, T1);
+    a.slli(T1, S1, 5);
+    a.xor_(S1, S1, T1);
+    a.andi(T2, S1, 1);
+    a.beq(T2, ZERO, skip1);
+    a.addi(S2, S2, 1);
+    a.Bind(skip1);
+    a.andi(T2, S1, 6);
+    a.bne(T2, ZERO, skip2);
+    a.jal(RA, func);
+    a.Bind(skip2);
+    a.addi(S0, S0, -1);
+    a.bne(S0, ZERO, loop);
+    a.jal(ZERO, done);
+    a.Bind(func);
+    a.addi(S3, S3, 1);
+    a.ret();
+    a.Bind(done);
+    a.exit();
+    return w;
+}
+
+//Counter and scratch CSR traffic while a timer interrupt fires every 200 cycles
+static Workload Csr_Irq(uint32_t scale){
+    Workload w{"csr_irq", "CSR accesses under a 200-cycle timer interrupt", {}};
+    Bench_Asm& a = w.program;
+    int handler = a.Label(), start = a.Label(), loop = a.Label();
+    a.jal(ZERO, start);
+
+    a.Bind(handler);    //Re-arm mtimecmp 200 cycles ahead; the high write clears the pending bit
+    a.li(T5, CLINT_MTIME);
+    a.lw(T6, 0, T5);
+    a.addi(T6, T6, 200);
+    a.li(T5, CLINT_MTIMECMP);
+    a.sw(T6, 0, T5);
+    a.sw(ZERO, 4, T5);
+    a.addi(S5, S5, 1);
+    a.mret();
+
+    a.Bind(start);
+    a.li(T0, a.labels[handler]);
+    a.csrw(0x305, T0);  //mtvec
+    a.li(T5, CLINT_MTIMECMP);
+    a.li(T6, 200);
+    a.sw(T6, 0, T5);
+    a.sw(ZERO, 4, T5);
+    a.li(T0, 1 << 7);
+    a.csrs(0x304, T0);  //mie.MTIE
+    a.li(T0, 1 << 3);
+    a.csrs(0x300, T0);  //mstatus.MIE
+    a.li(S0, 6000000 * scale);
+    a.Bind(loop);
+    a.csrr(T0, 0xB00);  //mcycle
+    a.csrr(T1, 0xB02);  //minstret
+    a.csrr(T2, 0x340);  //mscratch
+    a.add(T2, T2, T0);
+    a.csrw(0x340, T2);
+    a.addi(S0, S0, -1);
+    a.bne(S0, ZERO, loop);
+    a.csrw(0x300, ZERO);
+    a.exit();
+    return w;
+}
+
+//Console output: a 32-byte line over and over, one byte store per character
+static Workload Uart(uint32_t scale){
+    Workload w{"uart", "byte-by-byte console output", {}};
+    Bench_Asm& a = w.program;
+    int line = a.Label(), chars = a.Label();
+    a.li(S0, 20000 * scale);
+    a.li(S1, UART);
+    a.Bind(line);
+    a.li(A0, BENCH_DATA);
+    a.Bind(chars);
+    a.lbu(T0, 0, A0);
+    a.sb(T0, 0, S1);
+    a.addi(A0, A0, 1);
+    a.addi(T1, T0, -10);
+    a.bne(T1, ZERO, chars);
+    a.addi(S0, S0, -1);
+    a.bne(S0, ZERO, line);
+    a.exit();
+    return w;
+}
+
+//One PT_LOAD segment (RWX) at BENCH_BASE: the code, then data (text at BENCH_DATA)
+static bool Write_Elf(const std::string& path, const Bench_Asm& program, const std::string& data){
+    std::vector<uint8_t> image(BENCH_DATA - BENCH_BASE + data.size(), 0);
+    std::memcpy(image.data(), program.code.data(), program.code.size() * 4);
+    std::memcpy(image.data() + (BENCH_DATA - BENCH_BASE), data.data(), data.size());
+
+    uint8_t header[52 + 32] = {0x7F, 'E', 'L', 'F', 1, 1, 1};
+    auto put16 = [&](size_t at, uint32_t v){ header[at] = (uint8_t)v; header[at + 1] = (uint8_t)(v >> 8); };
+    auto put32 = [&](size_t at, uint32_t v){ for(int i = 0; i < 4; i++) header[at + i] = (uint8_t)(v >> (8 * i)); };
+    put16(16, 2);   //ET_EXEC
+    put16(18, 0xF3);    //RISC-V
+    put32(20, 1);
+    put32(24, BENCH_BASE);  //e_entry
+    put32(28, 52);  //e_phoff
+    put16(40, 52);
+    put16(42, 32);
+    put16(44, 1);
+    put16(46, 40);
+    put32(52, 1);   //PT_LOAD
+    put32(56, 0x1000);  //p_offset
+    put32(60, BENCH_BASE);
+    put32(64, BENCH_BASE);
+    put32(68, (uint32_t)image.size());
+    put32(72, BENCH_SIZE);
+    put32(76, 7);   //RWX
+    put32(80, 0x1000);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    std::vector<uint8_t> padding(0x1000 - sizeof(header), 0);
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(padding.data()), padding.size());
+    file.write(reinterpret_cast<const char*>(image.data()), image.size());
+    return (bool)file;
+}
+
+struct Run{
+    bool ok = false;
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    double seconds = 0; //Emulation time as reported by --stats, without startup
+    long peak_rss_kb = 0;
+};
+
+#ifndef _WIN32
+//Runs the emulator with --stats on elf, guest output discarded, and reads back its statistics
+static Run Run_Emulator(const std::string& emulator, const std::vector<std::string>& options, const std::string& elf){
+    Run run;
+    int out[2];
+    if(pipe(out) != 0) return run;
+
+    pid_t pid = fork();
+    if(pid == 0){
+        int null = open("/dev/null", O_RDONLY);
+        dup2(null, STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        close(out[1]);
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(emulator.c_str()));
+        for(const auto& option : options) argv.push_back(const_cast<char*>(option.c_str()));
+        argv.push_back(const_cast<char*>("--stats"));
+        argv.push_back(const_cast<char*>(elf.c_str()));
+        argv.push_back(nullptr);
+        execv(emulator.c_str(), argv.data());
+        _exit(127);
+    }
+    close(out[1]);
+    if(pid < 0){
+        close(out[0]);
+        return run;
+    }
+
+    std::string text, tail;  //Only "[Emulator]" lines matter, guest output can be megabytes
+    char buffer[65536];
+    ssize_t got;
+    while((got = read(out[0], buffer, sizeof(buffer))) > 0){
+        text.append(buffer, got);
+        size_t keep = text.rfind('\n');
+        if(keep != std::string::npos){
+            size_t at = 0;
+            while((at = text.find("[Emulator]", at)) != std::string::npos && at < keep){
+                size_t end = text.find('\n', at);
+                tail += text.substr(at, end - at) + "\n";
+                at = end;
+            }
+            text.erase(0, keep + 1);
+        }
+    }
+    tail += text;
+    close(out[0]);
+
+    int status = 0;
+    struct rusage usage;
+    if(wait4(pid, &status, 0, &usage) != pid) return run;
+    run.peak_rss_kb = usage.ru_maxrss;
+
+    size_t at = tail.find(" instructions, ");
+    size_t line = tail.rfind('\n', at);
+    unsigned long long instructions = 0, cycles = 0;
+    if(at == std::string::npos || std::sscanf(tail.c_str() + (line == std::string::npos ? 0 : line + 1),
+        "[Emulator] %llu instructions, %llu cycles in %lf s", &instructions, &cycles, &run.seconds) != 3) return run;
+    run.instructions = instructions;
+    run.cycles = cycles;
+    run.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && tail.find("exited with code 0") != std::string::npos;
+    return run;
+}
+#endif
+
+static std::string Json_String(const std::string& text){
+    std::string out = "\"";
+    for(char c : text){
+        if(c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+int main(int argc, char* argv[]){
+#ifdef _WIN32
+    (void)argc;
+    (void)argv;
+    std::cerr << "Error: The benchmark runner needs a POSIX host" << std::endl;
+    return 1;
+#else
+    std::string emulator, out_path = "bench.json", dir = "bench_workloads";
+    int runs = 3;
+    uint32_t scale = 1;
+    std::vector<std::string> options;
+
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if(arg == "--"){
+            options.assign(argv + i + 1, argv + argc);
+            break;
+        }
+        else if(arg.rfind("--emulator=", 0) == 0) emulator = arg.substr(11);
+        else if(arg.rfind("--out=", 0) == 0) out_path = arg.substr(6);
+        else if(arg.rfind("--dir=", 0) == 0) dir = arg.substr(6);
+        else if(arg.rfind("--runs=", 0) == 0) runs = std::max(1, std::atoi(arg.c_str() + 7));
+        else if(arg.rfind("--scale=", 0) == 0) scale = std::max(1, std::atoi(arg.c_str() + 8));
+        else{
+            std::cerr << "Error: Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    if(emulator.empty()){
+        std::cout << "Usage: ./bench --emulator=PATH [--out=FILE] [--runs=N] [--scale=N] [--dir=DIR] [-- EMULATOR_OPTIONS...]" << std::endl;
+        return 1;
+    }
+
+    std::vector<Workload> workloads = {Alu(scale), Memory(scale), Branch(scale), Csr_Irq(scale), Uart(scale)};
+    mkdir(dir.c_str(), 0755);
+
+    std::string option_text;
+    for(const auto& option : options) option_text += (option_text.empty() ? "" : " ") + option;
+
+    std::string json = "{\n  \"emulator\": " + Json_String(emulator) + ",\n  \"options\": " + Json_String(option_text)
+        + ",\n  \"runs\": " + std::to_string(runs) + ",\n  \"scale\": " + std::to_string(scale) + ",\n  \"workloads\": [\n";
+    double log_mips = 0;
+    bool all_ok = true;
+
+    std::printf("%-8s %14s %9s %9s %9s %10s\n", "workload", "instructions", "seconds", "MIPS", "ns/inst", "RSS KiB");
+    for(size_t i = 0; i < workloads.size(); i++){
+        Workload& w = workloads[i];
+        w.program.Finish();
+        std::string elf = dir + "/" + w.name + ".elf";
+        if(!Write_Elf(elf, w.program, "Benchmark line of UART output.\n")){
+            std::cerr << "Error: Cannot write \"" << elf << "\"" << std::endl;
+            return 1;
+        }
+
+        std::vector<Run> results;
+        for(int r = 0; r < runs; r++) results.push_back(Run_Emulator(emulator, options, elf));
+        bool ok = std::all_of(results.begin(), results.end(), [](const Run& run){ return run.ok; });
+        std::sort(results.begin(), results.end(), [](const Run& a, const Run& b){ return a.seconds < b.seconds; });
+        const Run& best = results.front();
+        double median = results[results.size() / 2].seconds;
+        long rss = 0;
+        for(const auto& run : results) rss = std::max(rss, run.peak_rss_kb);
+
+        double mips = best.seconds > 0 ? best.instructions / best.seconds / 1e6 : 0;
+        double ns = best.instructions ? best.seconds * 1e9 / best.instructions : 0;
+        all_ok = all_ok && ok;
+        log_mips += std::log(mips > 0 ? mips : 1e-9);
+
+        std::printf("%-8s %14llu %9.4f %9.1f %9.3f %10ld%s\n", w.name.c_str(), (unsigned long long)best.instructions,
+                    best.seconds, mips, ns, rss, ok ? "" : "  FAILED");
+        std::fflush(stdout);
+
+        char fields[512];
+        std::snprintf(fields, sizeof(fields), "\"instructions\": %llu, \"cycles\": %llu, \"seconds\": %.6f, \"seconds_median\": %.6f, "
+                      "\"mips\": %.3f, \"ns_per_instruction\": %.4f, \"peak_rss_kb\": %ld, \"ok\": %s",
+                      (unsigned long long)best.instructions, (unsigned long long)best.cycles, best.seconds, median, mips, ns, rss,
+                      ok ? "true" : "false");
+        json += "    {\"name\": " + Json_String(w.name) + ", \"description\": " + Json_String(w.description) + ", " + fields + "}"
+            + (i + 1 < workloads.size() ? ",\n" : "\n");
+    }
+
+    char summary[64];
+    std::snprintf(summary, sizeof(summary), "%.3f", std::exp(log_mips / workloads.size()));
+    json += "  ],\n  \"geomean_mips\": " + std::string(summary) + "\n}\n";
+    std::printf("geomean  %.1f MIPS, results in %s\n", std::exp(log_mips / workloads.size()), out_path.c_str());
+
+    std::ofstream file(out_path, std::ios::trunc);
+    file << json;
+    if(!file){
+        std::cerr << "Error: Cannot write \"" << out_path << "\"" << std::endl;
+        return 1;
+    }
+    return all_ok ? 0 : 1;
+#endif
+}
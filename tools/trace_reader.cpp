@@ -0,0 +1,55 @@
+//Decodes a --trace file written by the emulator.
+//Build: g++ -O2 -o trace_reader tools/trace_reader.cpp
+#include<cstdint>
+#include<cstdio>
+#include<cstdlib>
+#include<iostream>
+#include<string>
+#include<unordered_set>
+
+#include "../src/trace.h"
+
+int main(int argc, char* argv[]){
+    std::string path;
+    bool summary = false;
+    uint64_t limit = UINT64_MAX;
+
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if(arg == "--summary") summary = true;
+        else if(arg.rfind("--limit=", 0) == 0) limit = std::strtoull(arg.c_str() + 8, nullptr, 0);
+        else path = arg;
+    }
+
+    if(path.empty()){
+        std::cout << "Usage: ./trace_reader [--summary] [--limit=N] <trace_file>" << std::endl;
+        return 1;
+    }
+
+    Trace_Reader reader;
+    if(!reader.Open(path)){
+        std::cerr << "Error: \"" << path << "\" is not a trace file" << std::endl;
+        return 1;
+    }
+
+    uint64_t records = 0;
+    std::unordered_set<uint32_t> pcs;
+    uint32_t pc, raw;
+    while(records < limit && reader.Next(pc, raw)){
+        records++;
+        if(summary) pcs.insert(pc);
+        else std::printf("PC: 0x%x | Inst: 0x%x\n", pc, raw);
+    }
+
+    if(summary){
+        std::cout << "Hart " << reader.hart << ": " << records << " instructions, " << pcs.size() << " distinct PCs, "
+                  << reader.blocks << " blocks, " << reader.stored_bytes << " bytes";
+        if(records) std::cout << " (" << (double)reader.stored_bytes / records << " bytes per instruction)";
+        std::cout << std::endl;
+    }
+    if(reader.corrupt){
+        std::cerr << "Error: Trace is truncated or corrupt after " << records << " instructions" << std::endl;
+        return 1;
+    }
+    return 0;
+}